@@ -2,6 +2,7 @@
 #pragma once
 
 #include <cstdint>
+#include <bitset>
 #include <memory>
 #include <iostream>
 #include <string>
@@ -23,8 +24,11 @@ public:
         DRAW
     };
 
+    using Bitset = std::bitset<SIZE * SIZE>;
+
 public:
     Board();
+    Board(int candidate_dist_);
     virtual ~Board() = default;
 
     virtual std::unique_ptr<mcts::StateBase> GetCopy() const;
@@ -39,6 +43,8 @@ public:
     inline Color GetTurn() const;
     inline int GetTurnElapsed() const;
     inline State GetState() const;
+    inline bool IsCandidate(mcts::Action action) const;
+    inline const Bitset& GetCandidates() const;
 
     std::size_t Hash() const;
 
@@ -46,11 +52,13 @@ public:
     
     inline static const char* state2str(State state);
     const static int DEPTH = 3;
+    constexpr static int MAX_CANDIDATE_DIST = 4;
 
 private:
     void Reset();
     State CheckState(mcts::Action action) const;
     bool FiveInRow(Color color, Coord pos, Coord delta) const;
+    static const Bitset& Neighborhood(mcts::Action action, int dist);
 
     inline Color GetColor(Coord pos) const;
     inline Color GetColor(mcts::Action action) const;
@@ -62,6 +70,12 @@ private:
     int turn_elapsed;
     mcts::Action last_action;
     std::size_t black_hsum = 0, white_hsum = 0;
+
+    // empty cells within candidate_dist (chebyshev) of any stone, every
+    // empty cell while the board is empty or candidate_dist is 0
+    int candidate_dist = 0;
+    Bitset occupied;
+    Bitset candidates;
 };
 
 
@@ -34,6 +34,14 @@ inline Board::State Board::GetState() const {
     return state;
 }
 
+inline bool Board::IsCandidate(mcts::Action action) const {
+    return candidates.test(action);
+}
+
+inline const Board::Bitset& Board::GetCandidates() const {
+    return candidates;
+}
+
 
 inline mcts::Action Coord2Action(Coord coord) {
     return coord.r * SIZE + coord.c;
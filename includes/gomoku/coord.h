@@ -32,8 +32,14 @@ const Coord DELTA[4] = {
     Coord(0, 1),
 };
 
+// dihedral symmetries of the board, bit 2 transposes and bits 0-1 then
+// rotate clockwise by 90 degrees that many times
+const int N_SYMMETRIES = 8;
+
 inline bool Inside(Coord pos);
 inline bool Inside(int r, int c);
+inline Coord Transform(Coord pos, int sym);
+inline Coord InverseTransform(Coord pos, int sym);
 
 std::string Coord2String(Coord pos);
 std::string Coord2String(int r, int c);
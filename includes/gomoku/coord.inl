@@ -38,4 +38,20 @@ inline bool Inside(int r, int c) {
     return (0 <= r && r < SIZE) && (0 <= c && c < SIZE);
 }
 
+inline Coord Transform(Coord pos, int sym) {
+    if (sym & 4)
+        pos = Coord(pos.c, pos.r);
+    for (int i = 0; i < (sym & 3); i++)
+        pos = Coord(pos.c, SIZE - 1 - pos.r);
+    return pos;
+}
+
+inline Coord InverseTransform(Coord pos, int sym) {
+    for (int i = 0; i < (sym & 3); i++)
+        pos = Coord(SIZE - 1 - pos.c, pos.r);
+    if (sym & 4)
+        pos = Coord(pos.c, pos.r);
+    return pos;
+}
+
 }
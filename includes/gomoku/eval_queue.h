@@ -1,17 +1,21 @@
 
 #pragma once
 
+#include <iostream>
 #include <vector>
 #include <memory>
-#include <queue>
 #include <thread>
-#include <future>
+#include <atomic>
 #include <mutex>
-#include <utility>
+#include <deque>
+#include <chrono>
 #include <condition_variable>
+#include <utility>
 #include <unordered_set>
+#include <boost/program_options.hpp>
 #include "mcts/evaluator.h"
 #include "gomoku/evaluator.h"
+#include "gomoku/request_ring.h"
 
 
 
@@ -24,32 +28,144 @@ class EvaluationQueue : public mcts::EvaluatorBase {
 public:
     using Evaluator = std::unique_ptr<GomokuEvaluator>;
 
+    enum class Symmetry {
+        NONE,
+        RANDOM,
+        ENSEMBLE
+    };
+
+    struct Config {
+        size_t max_batch = 256;
+        size_t min_batch = 1;
+        int64_t max_wait_us = 0;
+        size_t capacity = 4096;
+        Symmetry symmetry = Symmetry::NONE;
+        bool priority = false;
+        int64_t max_age_us = 5000;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
 public:
     EvaluationQueue(Evaluator evaluator);
+    EvaluationQueue(Evaluator evaluator, Config conf);
     EvaluationQueue(std::vector<Evaluator> evaluators);
+    EvaluationQueue(std::vector<Evaluator> evaluators, Config conf, 
+                    int generation = 0);
     EvaluationQueue(EvaluationQueue&& other) = delete;
     virtual ~EvaluationQueue();
     
-    virtual Evaluation Evaluate(const mcts::StateBase* state);
+    using mcts::EvaluatorBase::Evaluate;
+    virtual Evaluation Evaluate(
+        const mcts::StateBase* state, const mcts::EvalHint& hint);
+    // every request is pushed before waiting, so they share batches
+    virtual std::vector<Evaluation> EvaluateBatch(
+        const std::vector<const mcts::StateBase*>& states, 
+        const std::vector<mcts::EvalHint>& hints);
+
+    // replaces every replica with a new model, each pipeline switches
+    // before its next forward, batches already in flight finish on the old one
+    void Reload(std::vector<Evaluator> evaluators, int generation);
+    // oldest model generation any pipeline still forwards with
+    int Generation() const;
+    // batching order of a request, lower is served first
+    static uint32_t Priority(const mcts::EvalHint& hint);
+
+    const Config config;
 
 private:
+    // lives on the stack of the searching thread for one evaluation
+    struct Request {
+        Input input;
+        Output output;
+        // lower is served first, see Priority
+        uint32_t priority = 0;
+        std::chrono::steady_clock::time_point enqueued;
+        std::atomic<uint32_t> done = 0;
+    };
+
+    // blocking handoff of batch slots between two pipeline stages
+    class SlotQueue {
+    public:
+        void Push(int slot);
+        bool Pop(int& slot);
+        void Close();
+
+    private:
+        std::deque<int> slots;
+        bool closed = false;
+        std::mutex m;
+        std::condition_variable cv;
+    };
+
+    // every evaluator runs assemble, forward and scatter on its own threads,
+    // a batch slot cycles free -> filled -> inferred -> free so the next
+    // batch is assembled while the current one is in forward
+    const static int PIPELINE_SLOTS = 3;
+    struct Pipeline {
+        std::shared_ptr<GomokuEvaluator> evaluator;
+        // replica each slot was forwarded by, kept alive until scattered
+        std::shared_ptr<GomokuEvaluator> forwarded[PIPELINE_SLOTS];
+        std::atomic<int> generation;
+        // set by Reload, taken by the forward thread between batches
+        std::mutex m_staged;
+        std::shared_ptr<GomokuEvaluator> staged;
+        int staged_generation;
+        Batch batches[PIPELINE_SLOTS];
+        std::vector<Request*> requests[PIPELINE_SLOTS];
+        SlotQueue free, filled, inferred;
+        std::thread assemble_thread, forward_thread, scatter_thread;
+    };
+
     // void EvaluationThread();
-    void EvaluationThread(Evaluator evaluator);
+    void StartPipeline(Evaluator evaluator, int generation);
+    void AssembleThread(Pipeline& pipeline);
+    void ForwardThread(Pipeline& pipeline);
+    void ScatterThread(Pipeline& pipeline);
+    void Submit(Request* requests, int n);
+    std::atomic<uint32_t>& WakeWord(const Request* request);
+    // until the request is scattered
+    void WaitDone(const Request& request);
+    bool CollectBatch(std::vector<Request*>& batch);
+    void SelectBatch(std::vector<Request*>& batch);
 
     // GomokuEvaluator evaluatos;
     // std::thread eval_thread;
     // std::vector<GomokuEvaluator> evaluators;
-    std::vector<std::thread> eval_threads;
-
-    bool running;
-    std::queue<std::pair<Input, std::promise<Output>*>> q;
-    std::mutex m_q;
-    std::condition_variable cv_q;
+    std::vector<std::unique_ptr<Pipeline>> pipelines;
+
+    std::atomic<bool> running;
+    RequestRing<Request> ring;
+    // number of requests pushed and not yet popped, evaluator threads
+    // sleep on it while the ring is empty
+    std::atomic<int> pending = 0;
+    // completions are announced on these words rather than on the
+    // requests, which outlive them only until their waiter sees done
+    const static int WAKE_WORDS = 64;
+    std::atomic<uint32_t> wake_words[WAKE_WORDS] = {};
+    // the collecting thread waits on cv_pending for min_batch until its
+    // deadline, submitters only take m_pending while collect_waiting is set
+    std::mutex m_pending;
+    std::condition_variable cv_pending;
+    std::atomic<bool> collect_waiting = false;
+
+    // held by the evaluator thread that is currently forming a batch,
+    // requests taken off the ring but not yet batched wait in the backlog
+    std::mutex m_collect;
+    std::deque<Request*> backlog;
 
     // std::unordered_set<std::size_t> hashes;
     // std::mutex m_s;
 };
 
 
+std::ostream& operator<<(std::ostream& out, EvaluationQueue::Symmetry symmetry);
+std::istream& operator>>(std::istream& in, EvaluationQueue::Symmetry& symmetry);
+
+
+boost::program_options::options_description 
+GetEvaluationQueueConfig(EvaluationQueue::Config& cfg);
+
+
 }
 
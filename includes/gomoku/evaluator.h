@@ -1,9 +1,10 @@
 
 #pragma once
 
+#include <iostream>
 #include <vector>
 #include <utility>
-#include <torch/script.h>
+#include <boost/program_options.hpp>
 #include "mcts/state.h"
 #include "mcts/evaluator.h"
 #include "gomoku/board.h"
@@ -18,35 +19,115 @@ using mcts::Prob;
 using mcts::Evaluation;
 
 
+// A position packed one bit per cell, in the (transformed) action order.
+// This is what travels through the queues, the float planes of the network
+// are only expanded per batch.
 struct Input {
-    Input() = default;
-    Input(Input&& other) = default;
-    Input& operator=(Input&& other) = default;
-
-    torch::Tensor state;
-    torch::Tensor turn;
-    torch::Tensor mask;
+    const static int PLANES = Board::DEPTH + 1;
+    const static int WORDS = (SIZE * SIZE + 63) / 64;
+
+    // stones of the side to move and of the opponent
+    uint64_t own[WORDS];
+    uint64_t opp[WORDS];
+    // cells the policy excludes, occupied or not a candidate
+    uint64_t masked[WORDS];
+    // side to move, 0 for black
+    int64_t turn;
 };
 
-using Output = std::pair<float, torch::Tensor>;
+// legal moves with their probabilities, ordered by action unless truncated
+using Policy = std::vector<std::pair<Action, Prob>>;
+using Output = std::pair<float, Policy>;
+
+
+// Inputs of a batch stacked into contiguous host buffers, and the raw
+// results a backend writes back for them.
+struct Batch {
+    void Clear();
+    void Push(const Input& input);
+    // expands the packed inputs into states and masks, before Forward
+    void Expand();
+
+    int size = 0;
+    std::vector<Input> inputs;
+    std::vector<float> states;
+    std::vector<int64_t> turns;
+    std::vector<uint8_t> masks;
+
+    // probs holds k entries per position, actions is empty when they are
+    // the dense SIZE * SIZE distribution and the k action indices otherwise
+    int k = 0;
+    std::vector<float> values;
+    std::vector<float> probs;
+    std::vector<int64_t> actions;
+};
 
 
 class GomokuEvaluator {
 public:
-    GomokuEvaluator(torch::jit::script::Module&& model_);
-    GomokuEvaluator(torch::jit::script::Module&& model_, torch::Device device_);
+    enum class Backend {
+        TORCH,
+        NATIVE
+    };
+
+    enum class Precision {
+        FP32,
+        BF16,
+        INT8
+    };
+
+    struct Config {
+        Backend backend = Backend::TORCH;
+        bool optimize = false;
+        bool save_optimized = false;
+        int intra_threads = 0;
+        int inter_threads = 0;
+        Precision precision = Precision::FP32;
+        int policy_topk = 0;
+        double policy_top_p = 1.;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+public:
+    GomokuEvaluator(Config conf);
     GomokuEvaluator(GomokuEvaluator&& other) = default;
+    virtual ~GomokuEvaluator() = default;
     
+    virtual void BindThread() const;
+    virtual void Forward(Batch& batch) = 0;
+    Output Unpack(const Batch& batch, int idx) const;
     std::vector<Output> EvaluateBatch(std::vector<Input>& inputs);
+    void Benchmark(
+        const std::vector<int>& batch_sizes, int iters, std::ostream& out);
 
     static Input Preprocess(const Board& board);
+    static Input Preprocess(const Board& board, int sym);
     static Evaluation Postprocess(Output&& output, const Board& board);
-
-private:
-    torch::jit::script::Module model;
-    torch::Device device;
+    static Evaluation Postprocess(
+        Output&& output, const Board& board, int sym);
+    static Evaluation Postprocess(
+        std::vector<Output>&& outputs, const Board& board, 
+        const std::vector<int>& syms);
+
+    const Config config;
+
+protected:
+    bool SparsePolicy() const;
+    Policy SelectPolicy(const float* probs, const uint8_t* mask) const;
+    void TruncatePolicy(Policy& policy) const;
 };
 
 
+std::ostream& operator<<(std::ostream& out, GomokuEvaluator::Backend backend);
+std::istream& operator>>(std::istream& in, GomokuEvaluator::Backend& backend);
+std::ostream& operator<<(std::ostream& out, GomokuEvaluator::Precision precision);
+std::istream& operator>>(std::istream& in, GomokuEvaluator::Precision& precision);
+
+
+boost::program_options::options_description 
+GetEvaluatorConfig(GomokuEvaluator::Config& cfg);
+
+
 }
 
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <iostream>
+#include <cstdint>
+#include <filesystem>
+#include "gomoku/evaluator.h"
+#include "gomoku/reader.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+// Training arrays in a single file, each float32, C order and 64-byte
+// aligned at the offsets given in the header:
+//   states     [n, Input::PLANES, SIZE, SIZE], as Batch::Expand fills them
+//   policies   [n, SIZE * SIZE], normalized visit counts
+//   values     [n], result for the side that just moved, 1 win, -1 loss,
+//              0 draw, as the search expects evaluations
+//   weights    [n], of the policy target, 1 for a fully searched move and
+//              0 for a fast search that only gives a value target
+// e.g. np.memmap(path, np.float32, 'r', offset=states, shape=(n, 4, 15, 15))
+struct DatasetHeader {
+    const static uint32_t MAGIC = 0x54534447;
+    const static uint32_t VERSION = 2;
+
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    int32_t size = SIZE;
+    int32_t planes = Input::PLANES;
+    uint64_t n = 0;
+    uint64_t states = 0;
+    uint64_t policies = 0;
+    uint64_t values = 0;
+    uint64_t weights = 0;
+};
+
+
+// Input and targets of the position before move, board being that position
+// and sym the symmetry applied to both.
+Input MakeSample(const LogReader& reader, size_t game, int move,
+    const Board& board, int sym, float* policy, float& value, float& weight);
+
+
+// Replays every game of a LogReader into a dataset file, games are split
+// over threads that write straight into the mapped output.
+class DatasetExporter {
+public:
+    struct Config {
+        size_t n_threads = 0;
+        // every position is written in all N_SYMMETRIES orientations
+        bool augment = false;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+public:
+    DatasetExporter(const Config& conf);
+    DatasetExporter(DatasetExporter&& other) = delete;
+
+    // returns the number of positions written
+    size_t Export(
+        const LogReader& reader, const std::filesystem::path& path) const;
+
+    const Config config;
+
+private:
+    struct Arrays {
+        float* states;
+        float* policies;
+        float* values;
+        float* weights;
+    };
+
+    void ExportGame(const LogReader& reader, size_t game, size_t first,
+        const Arrays& arrays, Batch& batch) const;
+};
+
+
+}
+}
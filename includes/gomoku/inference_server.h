@@ -0,0 +1,84 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <deque>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include "gomoku/evaluator.h"
+#include "gomoku/loader.h"
+#include "gomoku/shm_channel.h"
+
+
+
+namespace gomoku {
+
+
+// Serves one model to any number of selfplay processes over a ShmChannel,
+// so their requests are batched together by a single set of replicas.
+class InferenceServer {
+public:
+    using Evaluator = std::unique_ptr<GomokuEvaluator>;
+
+    struct Config {
+        ReplicaLoader::Config ld_cfg;
+        std::filesystem::path model_path;
+        std::string shm_name = "gomoku";
+        uint32_t n_slots = 4096;
+        size_t min_batch = 1;
+        int64_t max_wait_us = 0;
+        bool priority = false;
+        int64_t max_age_us = 5000;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+public:
+    InferenceServer(const Config& cfg);
+    InferenceServer(InferenceServer&& other) = delete;
+
+    // serves until RequestStop, reloads model_path on RequestReload
+    void Run();
+    // async-signal-safe
+    static void RequestStop();
+    static void RequestReload();
+
+    const Config config;
+
+private:
+    struct Replica {
+        Evaluator evaluator;
+        // set by a reload, taken by the serving thread between batches
+        std::mutex m_staged;
+        Evaluator staged;
+    };
+
+    void ServeThread(Replica& replica);
+    bool CollectBatch(std::vector<uint32_t>& idxs);
+    // the same selection as EvaluationQueue::SelectBatch, over slots
+    void SelectBatch(std::vector<uint32_t>& idxs);
+    void Reload();
+
+    ReplicaLoader loader;
+    std::unique_ptr<ShmChannel> channel;
+    std::vector<std::unique_ptr<Replica>> replicas;
+    std::atomic<bool> running;
+    int generation;
+    // held by the serving thread that is currently forming a batch,
+    // slots taken off the request ring but not yet batched wait in the
+    // backlog
+    std::mutex m_collect;
+    std::deque<uint32_t> backlog;
+};
+
+
+boost::program_options::options_description
+GetInferenceServerConfig(InferenceServer::Config& cfg);
+
+
+}
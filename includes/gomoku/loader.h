@@ -0,0 +1,56 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <string>
+#include <filesystem>
+#include "gomoku/evaluator.h"
+
+
+
+namespace gomoku {
+
+
+// Loads and warms up the evaluator replicas of a checkpoint, shared by the
+// selfplay server and the inference server.
+class ReplicaLoader {
+public:
+    using Evaluator = std::unique_ptr<GomokuEvaluator>;
+
+    struct Config {
+        GomokuEvaluator::Config ev_cfg;
+        size_t n_evaluators = 1;
+        std::vector<int> replica_threads;
+        int warmup_iters = 5;
+        std::vector<int> warmup_batches;
+        std::vector<int> report_batches;
+        size_t max_batch = 256;
+    };
+
+public:
+    ReplicaLoader(Config conf);
+
+    // one replica per evaluator, warmed up in parallel
+    std::vector<Evaluator> Load(
+        const std::filesystem::path& model, std::ostream& out) const;
+    void Report(GomokuEvaluator& ev, std::ostream& out) const;
+
+    // checkpoints are named like gen0012.pt, -1 without a number
+    static int ModelGeneration(const std::filesystem::path& model);
+
+    const Config config;
+
+private:
+    std::vector<int> ReplicaThreads() const;
+    Evaluator LoadReplica(
+        const std::filesystem::path& model, size_t idx, int threads,
+        std::ostream& out) const;
+    std::filesystem::path OptimizedPath(
+        const std::filesystem::path& model, const std::string& device) const;
+    std::vector<int> WarmupBatches() const;
+    void WarmUp(GomokuEvaluator& ev) const;
+};
+
+
+}
@@ -11,6 +11,11 @@ namespace gomoku {
 namespace logger {
 
 
+// A game as written by Save:
+//   Header | actions [len] | counts [len, SIZE * SIZE]
+//   Extension | full search flags [len] as bytes | searches [len]
+// Everything up to the counts is the original format, readers of it stop
+// there. Logs written before the extension end with the counts.
 class Log {
     struct Header {
         int32_t size = SIZE;
@@ -20,11 +25,24 @@ class Log {
     };
 
 public:
+    struct Extension {
+        const static uint32_t MAGIC = 0x5458454c;
+        const static uint32_t VERSION = 1;
+
+        uint32_t magic = MAGIC;
+        uint32_t version = VERSION;
+        // model generation the game started with
+        int32_t generation = 0;
+    };
+
     Log() = default;
     Log(int game_len, 
         Board::State result,
         const std::vector<mcts::Action>& actions, 
-        const std::vector<std::vector<int>>& counts);
+        const std::vector<std::vector<int>>& counts,
+        int generation = 0,
+        const std::vector<bool>& full_search = {},
+        const std::vector<int>& searches = {});
     Log(const Log& log);
     Log(Log&& log);
     Log& operator=(const Log& log);
@@ -33,11 +51,28 @@ public:
 
     void Save(const std::string& path) const;
 
+    int Length() const { return header.len; }
+    // 0 unfinished, 1 black win, 2 white win, 3 draw
+    int Result() const { return header.result; }
+    int Generation() const { return extension.generation; }
+    const int32_t* Actions() const { return actions_ptr; }
+    // visit counts of every action before move i
+    const int32_t* Counts(int i) const { return counts_ptr + i * flat; }
+    // move i was searched with the full budget, its counts are a policy
+    // target, a fast search only gives a value target
+    bool FullSearch(int i) const { return full_ptr[i]; }
+    // searches move i was given, its counts sum to more when the search
+    // started from visits made elsewhere, as from an opening book
+    int Searches(int i) const { return searches_ptr[i]; }
+
 private:
     Header header;
+    Extension extension;
     int flat = SIZE * SIZE;
     int32_t *actions_ptr = nullptr;
     int32_t *counts_ptr = nullptr;
+    uint8_t *full_ptr = nullptr;
+    int32_t *searches_ptr = nullptr;
 };
 
 
@@ -0,0 +1,67 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "nn/weights.h"
+#include "gomoku/evaluator.h"
+
+
+
+namespace gomoku {
+
+
+// Policy/value residual network evaluated with the kernels in nn, without
+// libtorch. Weights come from a nn::WeightFile written by export_weights,
+// tensors are looked up by the names of the reference model:
+//   stem.{conv,bn}                       3x3 conv, Board::DEPTH + 1 planes in
+//   blocks.{i}.{conv1,bn1,conv2,bn2}     residual blocks, 3x3 convs
+//   policy.{conv,bn}, policy.fc          1x1 conv and linear to SIZE * SIZE
+//   value.{conv,bn}, value.{fc1,fc2}     1x1 conv, hidden linear and tanh
+//   turn_embed.weight                    optional, [2, channels] added to
+//                                        the stem before its relu
+// Batch norms are folded into the preceding convolution at load time.
+class NativeEvaluator : public GomokuEvaluator {
+public:
+    NativeEvaluator(const std::string& weights_path);
+    NativeEvaluator(const std::string& weights_path, Config conf);
+    NativeEvaluator(const nn::WeightFile& weights, Config conf);
+    NativeEvaluator(NativeEvaluator&& other) = default;
+
+    virtual void Forward(Batch& batch);
+
+private:
+    struct Conv {
+        int c_out, c_in, kernel;
+        std::vector<float> w, b;
+    };
+
+    struct Dense {
+        int n_out, n_in;
+        std::vector<float> w, b;
+    };
+
+    static Conv LoadConv(
+        const nn::WeightFile& weights, const std::string& prefix, 
+        const std::string& conv, const std::string& bn, int c_in, int kernel);
+    static Dense LoadDense(
+        const nn::WeightFile& weights, const std::string& name, int n_in);
+
+    void Load(const nn::WeightFile& weights);
+    void ConvForward(
+        const Conv& conv, int batch, const float* in, const float* residual, 
+        bool relu, float* out);
+    void Flatten(int channels, int batch, const float* in, float* out) const;
+
+    Conv stem;
+    std::vector<std::pair<Conv, Conv>> blocks;
+    Conv policy_conv, value_conv;
+    Dense policy_fc, value_fc1, value_fc2;
+    std::vector<float> turn_embed;
+
+    std::vector<float> act, tmp, next, col, flat, hidden, logits, values;
+};
+
+
+}
+
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "mcts/tree.h"
+
+
+namespace gomoku {
+namespace selfplay {
+
+
+using mcts::MCTS;
+
+
+// Root stats of the shallow selfplay positions, pooled over games. Every
+// game goes through much the same first positions, so a search of one of
+// them starts from what earlier games found there and only tops it up.
+// Positions are keyed by their stones up to the board symmetries, and the
+// book is emptied when the model generation changes.
+class OpeningBook {
+public:
+    struct Config {
+        // positions with fewer stones are kept, 0 disables the book
+        int max_stones = 0;
+        // the stats of a position are halved once they pass this many
+        // visits, so that earlier searches fade out
+        int max_visits = 10000;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+public:
+    OpeningBook(const Config& conf);
+    OpeningBook(OpeningBook&& other) = delete;
+
+    bool Covers(int n_stones) const;
+    // stats of the position after actions, in its orientation, empty if
+    // it has none of this generation
+    std::vector<MCTS::ChildStats> Lookup(
+        const std::vector<mcts::Action>& actions, int generation);
+    // pools the visits a game added to the position after actions
+    void Add(const std::vector<mcts::Action>& actions, int generation,
+        const std::vector<MCTS::ChildStats>& stats);
+
+    size_t NumPositions() const;
+    // lookups, and those that found stats
+    size_t NumLookups() const;
+    size_t NumHits() const;
+
+    const Config config;
+
+private:
+    // the stones by color in the least of their orientations, and the
+    // symmetry that maps the position to it
+    static std::string Key(const std::vector<mcts::Action>& actions, int& sym);
+    // empties the book for a new generation
+    void Renew(int generation_);
+
+    mutable std::mutex m;
+    // stats of a position in the orientation of its key
+    std::unordered_map<std::string, std::vector<MCTS::ChildStats>> entries;
+    int generation = -1;
+    size_t n_lookups = 0, n_hits = 0;
+};
+
+
+}
+}
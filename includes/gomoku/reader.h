@@ -0,0 +1,204 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <cstdint>
+#include <filesystem>
+#include "mcts/tree.h"
+#include "gomoku/board.h"
+#include "gomoku/shard.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+// Read-only mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile(const std::filesystem::path& path_);
+    MappedFile(MappedFile&& other) = delete;
+    ~MappedFile();
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+    const std::filesystem::path path;
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+
+// Index of one log file, saved next to it as <file>.idx and rebuilt when
+// the file has changed since:
+//   IndexHeader, GameEntry * n_games, PositionEntry * n_positions
+struct IndexHeader {
+    const static uint32_t MAGIC = 0x4c58444e;
+    const static uint32_t VERSION = 3;
+
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    uint64_t n_games = 0;
+    uint64_t n_positions = 0;
+};
+
+struct GameEntry {
+    int64_t game_idx;
+    // of the action array in a Log file, of the record in a shard
+    uint64_t offset;
+    uint64_t first_position;
+    int32_t generation;
+    int32_t result;
+    int32_t len;
+    // visit counts stored dense, as Log::Save writes them
+    int32_t dense;
+};
+
+struct PositionEntry {
+    // of the visit counts row in a Log file, of the move in a shard
+    uint64_t offset;
+    uint32_t game;
+    uint16_t move;
+    // searched with the full budget, see Log::FullSearch
+    uint8_t full;
+    uint8_t pad = 0;
+    // see Log::Searches
+    int32_t searches;
+    // makes the tail padding explicit, so index files hold no stray bytes
+    uint32_t reserved = 0;
+};
+
+// written to index files as they are
+static_assert(sizeof(IndexHeader) == 40 && sizeof(GameEntry) == 40
+              && sizeof(PositionEntry) == 24, "index entries have padding");
+
+
+// Visited actions of one position, decoded in place from the mapping.
+class Visits {
+public:
+    class Iterator {
+    public:
+        std::pair<mcts::Action, int> operator*() const { return current; }
+        Iterator& operator++();
+        bool operator!=(const Iterator& other) const {
+            return left != other.left;
+        }
+
+    private:
+        friend class Visits;
+        void Next();
+
+        const uint8_t* ptr = nullptr;
+        const uint8_t* end = nullptr;
+        const int32_t* dense = nullptr;
+        int left = 0;
+        mcts::Action prev = -1;
+        std::pair<mcts::Action, int> current;
+    };
+
+    Visits() = default;
+    // a row of SIZE * SIZE counts, as Log::Save writes them
+    Visits(const int32_t* dense_);
+    // n_visited (action delta, visits) varint pairs, as in a shard
+    Visits(const uint8_t* ptr_, const uint8_t* end_, int n_visited_);
+
+    Iterator begin() const;
+    Iterator end() const { return Iterator(); }
+    int Size() const;
+
+private:
+    const int32_t* dense = nullptr;
+    const uint8_t* ptr = nullptr;
+    const uint8_t* end_ptr = nullptr;
+    int n_visited = 0;
+};
+
+
+// Games and positions of any mix of Log files and shards. Everything is
+// read through the mappings, nothing is copied on loading besides the
+// indices built for files that have none yet.
+class LogReader {
+public:
+    struct Game {
+        int64_t game_idx;
+        int generation;
+        // 0 unfinished, 1 black win, 2 white win, 3 draw
+        int result;
+        int length;
+    };
+
+    struct Position {
+        size_t game;
+        int move;
+    };
+
+public:
+    // directories are searched for .bin files
+    LogReader(const std::vector<std::filesystem::path>& paths,
+        bool save_index = true);
+    // path read again after it changed, the index of a shard that only grew
+    // since previous read it is extended from where its records ended
+    // instead of rebuilt
+    LogReader(const std::filesystem::path& path, const LogReader& previous,
+        bool save_index = true);
+    LogReader(LogReader&& other) = delete;
+
+    size_t NumFiles() const { return sources.size(); }
+    size_t NumGames() const { return game_base.back(); }
+    size_t NumPositions() const { return position_base.back(); }
+
+    Game GetGame(size_t game) const;
+    Position GetPosition(size_t position) const;
+    // position of the first move of game
+    size_t FirstPosition(size_t game) const;
+    // played at move, the visit counts it was chosen from
+    mcts::Action GetAction(size_t game, int move) const;
+    Visits GetVisits(size_t game, int move) const;
+    // the visit counts are a policy target, not only a fast search
+    bool FullSearch(size_t game, int move) const;
+    // searches the move was given, see Log::Searches
+    int Searches(size_t game, int move) const;
+    // board before move, after replaying the actions played so far
+    Board Replay(size_t game, int move, int candidate_dist = 0) const;
+    // uniform over positions, independent of the number of positions
+    size_t Sample(std::mt19937& gen) const;
+
+    static std::vector<std::filesystem::path> Collect(
+        const std::vector<std::filesystem::path>& paths);
+
+private:
+    struct Source {
+        std::unique_ptr<MappedFile> data, mapped_index;
+        // index of a file that could not be saved
+        std::string built_index;
+        const IndexHeader* header;
+        const GameEntry* games;
+        const PositionEntry* positions;
+    };
+
+    void Open(Source& source, bool save_index,
+        const Source* previous = nullptr);
+    static std::string BuildIndex(const MappedFile& file,
+        const Source* previous = nullptr);
+    // where the records previous indexed end, if file is the same shard
+    // with records only appended since
+    static bool ResumeOffset(const MappedFile& file, const Source& previous,
+        uint64_t& start);
+    size_t FindSource(const std::vector<size_t>& base, size_t idx) const;
+    const PositionEntry& GetEntry(size_t game, int move,
+        const Source*& source, const GameEntry*& entry) const;
+
+    std::vector<Source> sources;
+    // games and positions before each source, and the totals
+    std::vector<size_t> game_base, position_base;
+};
+
+
+}
+}
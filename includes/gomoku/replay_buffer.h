@@ -0,0 +1,141 @@
+#pragma once
+
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <unordered_set>
+#include <condition_variable>
+#include <filesystem>
+#include "gomoku/evaluator.h"
+#include "gomoku/reader.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+// Frame of a minibatch as the replay_buffer executable streams them to its
+// stdout, followed by the MiniBatch arrays in order, all float32:
+//   states [n, planes, size, size], policies [n, size * size], values [n],
+//   weights [n]
+// e.g. a trainer reading from the process,
+//   magic, version, size, planes, n = struct.unpack("<IIiiQ", pipe.read(24))
+//   states = np.frombuffer(
+//       pipe.read(n * planes * size * size * 4), np.float32)
+struct MiniBatchHeader {
+    const static uint32_t MAGIC = 0x48424d47;
+    const static uint32_t VERSION = 1;
+
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    int32_t size = SIZE;
+    int32_t planes = Input::PLANES;
+    uint64_t n = 0;
+};
+
+
+// Window over the most recent selfplay games, sampled uniformly into
+// minibatches. Log files and shards are picked up from the watched
+// directories as selfplay writes them, in file name order. Games are read
+// through the mappings of a LogReader per file, only the minibatches
+// themselves are held in memory.
+class ReplayBuffer {
+public:
+    struct Config {
+        std::vector<std::filesystem::path> dirs;
+        // window bounds, 0 for no bound
+        size_t max_games = 0;
+        size_t max_positions = 1000000;
+        // sampling waits until the window holds this many positions
+        size_t min_positions = 10000;
+        size_t batch_size = 256;
+        size_t n_threads = 2;
+        // minibatches sampled ahead of Next
+        size_t prefetch = 8;
+        // samples get a random board symmetry
+        bool augment = false;
+        double poll_interval = 5;
+        bool save_index = false;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+    // laid out as the DatasetHeader arrays
+    struct MiniBatch {
+        size_t size = 0;
+        std::vector<float> states;
+        std::vector<float> policies;
+        std::vector<float> values;
+        std::vector<float> weights;
+    };
+
+public:
+    ReplayBuffer(const Config& conf);
+    ReplayBuffer(ReplayBuffer&& other) = delete;
+    ~ReplayBuffer();
+
+    // blocks until a minibatch is ready, false once stopped
+    bool Next(MiniBatch& batch);
+    void Stop();
+    // picks up new and grown files now instead of on the next poll
+    void Ingest();
+
+    size_t NumGames() const;
+    size_t NumPositions() const;
+
+    const Config config;
+
+private:
+    struct Segment {
+        std::shared_ptr<const LogReader> reader;
+        size_t first_game;
+        size_t first_position;
+    };
+
+    // immutable once published, samplers keep it alive while in use
+    struct Window {
+        std::vector<Segment> segments;
+        // positions before each segment, and the total
+        std::vector<size_t> base = {0};
+        size_t n_games = 0;
+    };
+
+    struct File {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+        std::shared_ptr<const LogReader> reader;
+    };
+
+    void IngestThread();
+    void SampleThread();
+    void Sample(const Window& window, MiniBatch& mini, Batch& batch,
+        std::mt19937& gen) const;
+    // n_dropped leading files have no game left in the window
+    std::shared_ptr<const Window> BuildWindow(size_t& n_dropped) const;
+
+    // owned by whoever holds m_ingest
+    std::mutex m_ingest;
+    std::vector<File> files;
+    std::unordered_set<std::string> retired;
+
+    mutable std::mutex m_window;
+    std::condition_variable cv_window, cv_poll;
+    std::shared_ptr<const Window> window;
+
+    std::mutex m_ready;
+    std::condition_variable cv_ready, cv_space;
+    std::deque<MiniBatch> ready;
+    bool running = true;
+
+    std::thread ingester;
+    std::vector<std::thread> samplers;
+};
+
+
+}
+}
@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+
+namespace gomoku {
+
+
+// Bounded multi-producer multi-consumer ring of request pointers.
+// Every cell carries a sequence number telling whether it is ready to be
+// written or read at the current lap, so neither side takes a lock and
+// no memory is allocated after construction.
+template <typename T>
+class RequestRing {
+public:
+    RequestRing(size_t capacity);
+    RequestRing(RequestRing&& other) = delete;
+
+    bool TryPush(T* item);
+    bool TryPop(T*& item);
+    inline size_t Capacity() const;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T* item;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+
+}
+
+#include "request_ring.inl"
+
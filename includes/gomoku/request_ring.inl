@@ -0,0 +1,78 @@
+
+#include <bit>
+#include <stdexcept>
+#include "gomoku/request_ring.h"
+
+
+namespace gomoku {
+
+template <typename T>
+RequestRing<T>::RequestRing(size_t capacity) {
+    if (capacity == 0)
+        throw std::runtime_error("RequestRing capacity must be positive");
+    capacity = std::bit_ceil(capacity);
+    cells = std::make_unique<Cell[]>(capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        cells[i].seq.store(i, std::memory_order_relaxed);
+        cells[i].item = nullptr;
+    }
+    mask = capacity - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool RequestRing<T>::TryPush(T* item) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+        if (diff == 0) {
+            if (head.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                cell.item = item;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool RequestRing<T>::TryPop(T*& item) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                item = cell.item;
+                cell.seq.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+inline size_t RequestRing<T>::Capacity() const {
+    return mask + 1;
+}
+
+}
+
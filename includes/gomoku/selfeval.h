@@ -1,10 +1,21 @@
-
 #pragma once
 
 #include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
 #include <filesystem>
+#include <boost/program_options.hpp>
 #include <indicators/block_progress_bar.hpp>
 #include "mcts/tree.h"
+#include "gomoku/board.h"
+#include "gomoku/eval_queue.h"
+#include "gomoku/loader.h"
+#include "gomoku/writer.h"
 
 
 namespace gomoku {
@@ -24,32 +35,104 @@ struct AgentConfig {
 };
 
 
+// Sequential probability ratio test on the score of agent1 against agent2,
+// H0 an elo difference of elo0 against H1 one of elo1, with the
+// trinomial normal approximation of the log likelihood ratio.
+class SPRT {
+public:
+    struct Config {
+        double elo0 = 0;
+        double elo1 = 10;
+        // false positive and false negative rates
+        double alpha = 0.05;
+        double beta = 0.05;
+
+        friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
+    };
+
+    enum class Result {
+        NONE,
+        // agent1 is no stronger than elo0, it fails
+        H0,
+        // agent1 is stronger by elo1, it passes
+        H1
+    };
+
+public:
+    SPRT(const Config& conf);
+
+    // 1 for a win of agent1, 0.5 for a draw, 0 for a loss
+    void Add(double score);
+    double LLR() const;
+    double LowerBound() const;
+    double UpperBound() const;
+    Result Decide() const;
+    // elo of agent1 over agent2, and the half width of its 95% interval
+    std::pair<double, double> Elo() const;
+
+    int wins = 0, draws = 0, losses = 0;
+    const Config config;
+};
+
+
 class Server {
 public:
     struct Config {
         AgentConfig agent1, agent2;
+        ReplicaLoader::Config ld_cfg;
+        EvaluationQueue::Config eq_cfg;
+        SPRT::Config sprt_cfg;
         std::filesystem::path out_dir;
         size_t max_games;
+        size_t n_workers;
+        // the first moves are sampled by visit counts so that games differ,
+        // the rest are the most visited
+        size_t sample_steps = 4;
+        int candidate_dist = 0;
 
         friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
     };
 
 public:
     Server(const Config& cfg);
+    Server(Server&& other) = delete;
     ~Server() = default;
 
-    void Run();
+    // plays until the test decides or max_games are played
+    SPRT::Result Run();
     void LoadEvauator();
 
     const Config config;
-    
+
 private:
+    ReplicaLoader::Config LoaderConfig() const;
+    void ThreadJob();
+    // score of agent1, negative for a game abandoned once the test decided
+    double SingleGame(int game_idx);
+    mcts::Action SelectMove(
+        const std::vector<MCTS::ActionInfo>& infos, int turn) const;
+
+    ReplicaLoader loader;
+    // of agent1 and agent2
+    std::unique_ptr<EvaluationQueue> evaluators[2];
+    std::atomic<int> game_idx;
+
+    std::mutex m_master;
+    SPRT sprt;
+    SPRT::Result result = SPRT::Result::NONE;
+    std::atomic<bool> decided = false;
+    std::unique_ptr<pb::BlockProgressBar> master_pbar;
+
+    std::unique_ptr<logger::AsyncWriter> writer;
+};
 
 
-};
+std::ostream& operator<<(std::ostream& out, SPRT::Result result);
 
 
+boost::program_options::options_description
+GetSelfevalConfig(Server::Config& cfg);
+
 
 }
 }
-
@@ -7,7 +7,10 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <chrono>
+#include <sstream>
 #include <filesystem>
 #include <boost/program_options.hpp>
 #include <indicators/block_progress_bar.hpp>
@@ -15,6 +18,10 @@
 #include <indicators/indeterminate_progress_bar.hpp>
 #include "mcts/tree.h"
 #include "gomoku/eval_queue.h"
+#include "gomoku/loader.h"
+#include "gomoku/opening_book.h"
+#include "gomoku/shm_evaluator.h"
+#include "gomoku/writer.h"
 
 
 namespace gomoku {
@@ -31,6 +38,41 @@ struct SelfplayConfig {
     size_t noise_steps = 3;
     double noise_alpha = 0.03;
     double noise_eps = 0.25;
+    int candidate_dist = 0;
+    // the side to move resigns once both its root value and the q of its
+    // most visited move stay below resign_threshold for resign_moves of
+    // its moves in a row, -1 never resigns
+    double resign_threshold = -1;
+    int resign_moves = 3;
+    // fraction of games played out regardless, to measure false resignations
+    double resign_playout = 0.1;
+    // playout cap randomization: a move is searched with compute_budget
+    // and logged as a policy target with this probability, otherwise with
+    // fast_budget, without root noise, and only used as a value target
+    double full_search_prob = 1.0;
+    size_t fast_budget = 100;
+    // a full search stops after min_budget times compute_budget when the
+    // root prior is sharper than sharp_prior or the best child holds the
+    // dominance share of the visits, and goes on past compute_budget up
+    // to max_budget times it while the two best children are within
+    // close_visits of each other in visits or close_q in q. What a move
+    // saves is banked for later moves of the game, which never spends
+    // more than compute_budget per full move
+    bool adaptive_budget = false;
+    double min_budget = 0.25;
+    double max_budget = 2.0;
+    double sharp_prior = 0.9;
+    double dominance = 0.7;
+    double close_visits = 0.8;
+    double close_q = 0.02;
+    // root stats of the positions with fewer than opening_stones stones
+    // are pooled over games in an OpeningBook. A full search of such a
+    // position starts from them and searches what is left of its budget,
+    // at least opening_top_up of it, with its own root noise and sampling.
+    // an adaptive budget extends such a move on its own visits alone
+    int opening_stones = 0;
+    double opening_top_up = 0.25;
+    int opening_visits = 10000;
 };
 
 
@@ -38,12 +80,31 @@ class Server {
 public:
     struct Config {
         MCTS::Config mcts_cfg;
+        GomokuEvaluator::Config ev_cfg;
+        EvaluationQueue::Config eq_cfg;
         SelfplayConfig sp_cfg;
         std::filesystem::path model_path;
         std::filesystem::path out_dir;
+        std::string shm_name;
         size_t starting_index;
         size_t max_games;
         size_t n_workers;
+        // games each worker advances together, with one evaluation batch
+        // for a leaf of every game, 0 for a game per worker searched by its
+        // own mcts threads
+        size_t games_per_worker = 0;
+        size_t n_evaluators;
+        std::vector<int> replica_threads;
+        std::vector<int> report_batches;
+        int warmup_iters = 5;
+        std::vector<int> warmup_batches;
+        double reload_interval = 0;
+        // games are appended to shards of this size, 0 for a file per game
+        size_t shard_mb = 256;
+        bool shard_sync = false;
+        // text trace per game, 0 none, 1 result, 2 moves, 3 boards
+        int verbosity = 3;
+        size_t write_queue = 64;
 
         friend std::ostream& operator<<(std::ostream& out, const Config& cfg);
     };
@@ -54,25 +115,108 @@ public:
 
     void Run();
     void LoadEvauator();
+    // async-signal-safe, the watcher reloads model_path on its next wakeup
+    static void RequestReload();
 
     const Config config;
 
 private:
+    ReplicaLoader::Config LoaderConfig() const;
+    OpeningBook::Config BookConfig() const;
+    mcts::EvaluatorBase& Evaluator() const;
+    int Generation() const;
+    void WatchThread();
+    bool ModelChanged();
+    void ReloadEvaluator();
+    // a game in progress, searched a move at a time either by its own
+    // worker or together with the other games of a driver
+    struct Game {
+        int idx;
+        Board board;
+        std::unique_ptr<MCTS> tree;
+        // the trace is kept in memory and handed to the writer with the game
+        std::ostringstream out;
+        std::vector<mcts::Action> actions;
+        std::vector<std::vector<int>> counts;
+        std::vector<bool> full_search;
+        // searches of each move, without the opening book visits in counts
+        std::vector<int> searches;
+        int start_generation;
+        // roots expanded right away by Reset, otherwise by the first leaf
+        bool expand;
+        bool can_resign;
+        int low_moves[3] = {0, 0, 0};
+        Color resigner = EMPTY;
+        int resign_move = -1;
+
+        // the move being searched
+        bool full;
+        bool noise;
+        // the root got its book stats and noise
+        bool prepared;
+        // searched from the opening book, with these stats of the
+        // generation it was looked up in
+        bool book;
+        std::vector<MCTS::ChildStats> book_stats;
+        int book_generation;
+        int book_visits;
+        size_t budget;
+        size_t searched;
+        // searches saved by earlier moves, see SelfplayConfig::adaptive_budget
+        int64_t bank = 0;
+        int full_moves = 0;
+        int64_t full_searched = 0;
+        std::chrono::system_clock::time_point st, total_st;
+    };
+
     void ThreadJob(int pbar_idx);
+    void DriverJob(int pbar_idx);
     int SingleSelfplay(int game_idx, int pbar_idx);
+    std::unique_ptr<Game> StartGame(
+        int game_idx, const MCTS::Config& mcts_cfg, bool expand);
+    void StartMove(Game& game);
+    // adds the opening book stats and the noise once the root is expanded
+    void PrepareRoot(Game& game);
+    // raises the budget of a move that has searched it all, when an
+    // adaptive budget wants more searches
+    void AdaptBudget(Game& game) const;
+    // plays the searched move, false once the game is over
+    bool EndMove(Game& game);
+    void EndGame(Game& game);
     mcts::Action SelectMove(
         const std::vector<MCTS::ActionInfo>& infos, int turn) const;
     
+    ReplicaLoader loader;
+    OpeningBook book;
     std::unique_ptr<EvaluationQueue> evaluator;
+    std::unique_ptr<ShmEvaluator> remote;
     std::atomic<int> game_idx;
 
+    // checkpoint currently served, model_path may be a symlink to it
+    std::filesystem::path model_file;
+    std::filesystem::file_time_type model_time;
+    int generation;
+    // last state seen by the watcher, a reload waits until it settles
+    std::filesystem::path seen_file;
+    std::filesystem::file_time_type seen_time;
+    std::thread watcher;
+    std::mutex m_watch;
+    std::condition_variable cv_watch;
+    bool watching;
+
     std::unique_ptr<pb::BlockProgressBar> master_pbar;
     std::vector<std::unique_ptr<pb::IndeterminateProgressBar>> bars;
     pb::DynamicProgress<pb::IndeterminateProgressBar> pbar;
     std::mutex m_master;
     int total, done;
+    // resigned games, and played out games a resignation would have
+    // decided, wrongly for n_false_resign of them
+    int n_resigned = 0, n_would_resign = 0, n_false_resign = 0;
+    // searches of the adaptive full moves
+    int64_t n_full_moves = 0, n_full_searches = 0;
 
     std::filesystem::path out_state_dir, out_txt_dir;
+    std::unique_ptr<logger::AsyncWriter> writer;
 };
 
 
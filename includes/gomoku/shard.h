@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <filesystem>
+#include "gomoku/logger.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+// Append-only file holding many games, little-endian:
+//   ShardHeader
+//   record*        RECORD_MAGIC, payload size, crc32, payload
+//   index footer   INDEX_MAGIC, n, n * (game index, record offset),
+//                  index offset, FOOTER_MAGIC
+// A payload is varints: game index, generation, result, length, then per
+// move the action, 1 if it was searched with the full budget, the searches
+// it was given, the number of visited actions and their (action delta,
+// visits) pairs in increasing action order. Version 1 shards have no full
+// search flag, every move of them counts as fully searched, and before
+// version 3 the searches of a move are the sum of its visits.
+// The footer is only written when a shard is closed. A shard left without
+// one by a crash is still read by scanning its records, and reopening it
+// drops a torn last record.
+struct ShardHeader {
+    const static uint32_t MAGIC = 0x44485347;
+    const static uint32_t VERSION = 3;
+
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    int32_t size = SIZE;
+    uint32_t flags = 0;
+};
+
+const static uint32_t RECORD_MAGIC = 0x43455247;
+const static uint32_t INDEX_MAGIC = 0x58444947;
+const static uint32_t FOOTER_MAGIC = 0x544f4647;
+// magic, payload size, crc32
+const static size_t RECORD_HEADER = 3 * sizeof(uint32_t);
+
+
+class ShardWriter {
+public:
+    struct Config {
+        std::filesystem::path dir;
+        // a shard is closed and the next one started past this size
+        size_t max_bytes = 256 << 20;
+        // fsync after every record, survives power loss not only crashes
+        bool sync = false;
+    };
+
+public:
+    ShardWriter(const Config& conf);
+    ShardWriter(ShardWriter&& other) = delete;
+    ~ShardWriter();
+
+    void Append(const Log& log, int64_t game_idx);
+    // a single write per shard for the whole batch
+    void Append(const std::vector<std::pair<const Log*, int64_t>>& games);
+    void Close();
+
+    const Config config;
+
+private:
+    static std::string Encode(const Log& log, int64_t game_idx);
+    void Open();
+    void Flush(std::string& records);
+    void Write(const std::string& data);
+    void Recover(const std::filesystem::path& path);
+
+    std::mutex m;
+    int fd = -1;
+    int shard_idx = 0;
+    std::filesystem::path path;
+    uint64_t offset = 0;
+    std::vector<std::pair<int64_t, uint64_t>> index;
+};
+
+
+std::filesystem::path ShardPath(const std::filesystem::path& dir, int idx);
+// (game index, offset) of every record in the mapped shard from the record
+// at start on, read from the footer of a closed shard, or scanned up to the
+// first torn record of one left open, returns where the records end
+uint64_t ScanRecords(const uint8_t* data, uint64_t size,
+    std::vector<std::pair<int64_t, uint64_t>>& records,
+    uint64_t start = sizeof(ShardHeader));
+
+void PutVarint(std::string& out, uint64_t value);
+// false when the varint runs past end
+bool GetVarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value);
+uint32_t Crc32(const uint8_t* data, size_t size);
+
+
+}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "gomoku/evaluator.h"
+
+
+
+namespace gomoku {
+
+
+// Request transport between selfplay processes and the inference server,
+// laid out in a POSIX shared memory segment:
+//   Header | free ring | request ring | slots
+// A client takes a slot index off the free ring, writes the input into the
+// slot and pushes the index to the request ring. The server batches indices
+// from the request ring across all clients, writes the outputs back and
+// marks the slots done, then the client returns the index to the free ring.
+// Slots of a client process that died are returned by the server instead.
+class ShmChannel {
+public:
+    const static uint32_t MAGIC = 0x4d485347;
+    const static uint32_t VERSION = 3;
+
+    // slot state, also the futex word the client sleeps on
+    const static uint32_t IDLE = 0;
+    const static uint32_t SUBMITTED = 1;
+    const static uint32_t DONE = 2;
+
+    struct Slot {
+        alignas(64) std::atomic<uint32_t> state;
+        // pid of the client holding the slot, 0 while it is free
+        std::atomic<int32_t> owner;
+        // EvaluationQueue::Priority of the request, and when it was
+        // submitted in steady_clock nanoseconds, the same clock for every
+        // process
+        uint32_t priority;
+        int64_t enqueued;
+        Input input;
+        float value;
+        int32_t n_policy;
+        int32_t actions[SIZE * SIZE];
+        float probs[SIZE * SIZE];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t n_slots;
+        uint32_t slot_size;
+        int32_t server_pid;
+        std::atomic<uint32_t> alive;
+        std::atomic<int32_t> generation;
+        // requests pushed and not yet popped, the server sleeps on it
+        alignas(64) std::atomic<uint32_t> pending;
+    };
+
+public:
+    // creates the segment, replacing a stale one of the same name
+    ShmChannel(const std::string& name, uint32_t n_slots);
+    // attaches to the segment of a running server
+    ShmChannel(const std::string& name);
+    ShmChannel(ShmChannel&& other) = delete;
+    ~ShmChannel();
+
+    Header& GetHeader() const;
+    // false once the server stopped or its process is gone
+    bool ServerAlive() const;
+    Slot& GetSlot(uint32_t idx) const;
+    bool TryAcquire(uint32_t& idx);
+    void Release(uint32_t idx);
+    void Submit(uint32_t idx, uint32_t priority);
+    bool TryTake(uint32_t& idx);
+    void Complete(uint32_t idx);
+    // returns the idle and done slots of client processes that are gone,
+    // a slot still submitted is reclaimed once the server completed it
+    int Reclaim();
+
+    // futex on a word of the segment, wakes up at the latest after timeout
+    static void Wait(
+        std::atomic<uint32_t>& word, uint32_t old, int64_t timeout_us);
+    static void Wake(std::atomic<uint32_t>& word, int n);
+
+    const std::string name;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> seq;
+        uint32_t idx;
+    };
+
+    // the same sequence ring as RequestRing, over slot indices in place
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+    };
+
+    static size_t Size(uint32_t n_slots);
+    void Map(int fd, size_t size);
+    Ring& GetRing(int ring) const;
+    Cell* GetCells(int ring) const;
+    bool TryPush(int ring, uint32_t idx);
+    bool TryPop(int ring, uint32_t& idx);
+
+    const static int FREE_RING = 0;
+    const static int REQUEST_RING = 1;
+
+    bool owner;
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    uint32_t n_slots = 0;
+};
+
+
+}
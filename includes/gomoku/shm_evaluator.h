@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "mcts/evaluator.h"
+#include "gomoku/evaluator.h"
+#include "gomoku/eval_queue.h"
+#include "gomoku/shm_channel.h"
+
+
+
+namespace gomoku {
+
+
+// Client of the inference server, evaluates positions through the shared
+// memory channel instead of a model of its own. Pre- and postprocessing,
+// including the board symmetries, stay in the client.
+class ShmEvaluator : public mcts::EvaluatorBase {
+public:
+    ShmEvaluator(const std::string& name);
+    ShmEvaluator(const std::string& name, EvaluationQueue::Symmetry symmetry_);
+    ShmEvaluator(ShmEvaluator&& other) = delete;
+
+    using mcts::EvaluatorBase::Evaluate;
+    virtual Evaluation Evaluate(
+        const mcts::StateBase* state, const mcts::EvalHint& hint);
+    // submitted as far as free slots allow, the oldest are received to
+    // make room for the rest
+    virtual std::vector<Evaluation> EvaluateBatch(
+        const std::vector<const mcts::StateBase*>& states, 
+        const std::vector<mcts::EvalHint>& hints);
+
+    // generation of the model the server currently serves
+    int Generation() const;
+
+    const EvaluationQueue::Symmetry symmetry;
+
+private:
+    uint32_t Submit(const Input& input, uint32_t priority);
+    bool TrySubmit(const Input& input, uint32_t priority, uint32_t& idx);
+    Output Receive(uint32_t idx);
+
+    ShmChannel channel;
+};
+
+
+}
@@ -0,0 +1,35 @@
+
+#pragma once
+
+#include <vector>
+#include <torch/script.h>
+#include "gomoku/evaluator.h"
+
+
+
+namespace gomoku {
+
+
+class TorchEvaluator : public GomokuEvaluator {
+public:
+    TorchEvaluator(torch::jit::script::Module&& model_);
+    TorchEvaluator(torch::jit::script::Module&& model_, Config conf);
+    TorchEvaluator(torch::jit::script::Module&& model_, torch::Device device_);
+    TorchEvaluator(
+        torch::jit::script::Module&& model_, torch::Device device_, Config conf);
+    TorchEvaluator(TorchEvaluator&& other) = default;
+
+    virtual void BindThread() const;
+    virtual void Forward(Batch& batch);
+    void Save(const std::string& path) const;
+
+private:
+    void Prepare();
+
+    torch::jit::script::Module model;
+    torch::Device device;
+};
+
+
+}
+
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include "gomoku/logger.h"
+#include "gomoku/shard.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+// Moves selfplay output off the game threads. Jobs are queued and written
+// in batches by a single thread, games to the shards when given and to a
+// file per game otherwise. A full queue blocks the caller, so a stalled
+// disk slows selfplay down instead of growing memory.
+class AsyncWriter {
+public:
+    struct Config {
+        size_t max_pending = 64;
+    };
+
+public:
+    AsyncWriter(const Config& conf, std::unique_ptr<ShardWriter> shards_);
+    AsyncWriter(AsyncWriter&& other) = delete;
+    ~AsyncWriter();
+
+    // replaces the file at path with text
+    void WriteText(std::filesystem::path path, std::string text);
+    // path is only used without shards
+    void WriteGame(Log&& log, int64_t game_idx, std::filesystem::path path);
+    // writes everything queued, then closes the current shard
+    void Close();
+
+    const Config config;
+
+private:
+    struct Job {
+        std::filesystem::path path;
+        std::string text;
+        bool is_game = false;
+        Log log;
+        int64_t game_idx = 0;
+    };
+
+    void Push(Job&& job);
+    void WriteThread();
+    void WriteBatch(std::vector<Job>& batch);
+
+    std::unique_ptr<ShardWriter> shards;
+    std::deque<Job> pending;
+    std::mutex m;
+    std::condition_variable cv_pending, cv_space;
+    bool closing = false;
+    std::thread writer;
+};
+
+
+}
+}
@@ -11,11 +11,32 @@ namespace mcts {
 using Evaluation = std::pair<Reward, std::vector<std::pair<Action, Prob>>>;
 
 
+// what the search knows about a pending evaluation, for scheduling
+struct EvalHint {
+    int remaining = 0;
+    int depth = 0;
+};
+
+
 class EvaluatorBase {
 public:
     virtual ~EvaluatorBase() = default;
     
-    virtual Evaluation Evaluate(const StateBase* state) = 0;
+    Evaluation Evaluate(const StateBase* state) {
+        return Evaluate(state, EvalHint());
+    }
+    virtual Evaluation Evaluate(const StateBase* state, const EvalHint& hint) = 0;
+    // evaluations in the order of states, an evaluator that batches
+    // requests should take them all at once rather than one at a time
+    virtual std::vector<Evaluation> EvaluateBatch(
+        const std::vector<const StateBase*>& states, 
+        const std::vector<EvalHint>& hints) {
+        std::vector<Evaluation> ret;
+        for (size_t i = 0; i < states.size(); i++) {
+            ret.push_back(Evaluate(states[i], hints[i]));
+        }
+        return ret;
+    }
 };
 
 }
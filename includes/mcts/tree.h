@@ -28,6 +28,8 @@ private:
         void Expand(const std::vector<std::pair<Action, Prob>>& prob_distribution);
         std::pair<Action, Node*> Select(double p_uct) const;
         void Update(Reward z);
+        // n results summing to w at once, as n calls of Update
+        void Add(int n_, double w_);
         void ApplyVirtualLoss(int vloss);
         void RevertVirtualLoss(int vloss);
         double UCT(double p_uct) const;
@@ -72,18 +74,53 @@ public:
             : action(action_), p(p_), n(n_), q(q_), uct(uct_) {}
     };
 
+    // visits of a root child and their total reward, for the root's side
+    // to move as ActionInfo::q
+    struct ChildStats {
+        Action action;
+        int n;
+        double w;
+    };
+
+    // a leaf selected under virtual loss and waiting for its evaluation
+    struct Leaf {
+        std::unique_ptr<StateBase> state;
+        EvalHint hint;
+
+    private:
+        friend class MCTS;
+        Node* node = nullptr;
+    };
+
 public:
     MCTS(const StateBase& init_state, EvaluatorBase& evaluator);
-    MCTS(const StateBase& init_state, EvaluatorBase& evaluator, Config conf);
+    // the root is expanded right away unless expand is false, then the
+    // first leaf selected is the root itself
+    MCTS(const StateBase& init_state, EvaluatorBase& evaluator, Config conf,
+         bool expand = true);
     MCTS(MCTS&& other) = delete;
     ~MCTS();
 
     void Search(int times);
+    // one search split around its evaluation, for callers that gather the
+    // leaves of many trees into a batch themselves, with n_threads 0.
+    // SelectLeaf returns false when the leaf was terminal and is already
+    // backed up
+    bool SelectLeaf(Leaf& leaf, int remaining = 0);
+    void BackupLeaf(Leaf& leaf, const Evaluation& output);
+    bool RootExpanded() const;
     void Play(Action action);
-    void Reset(const StateBase& init_state);
+    void Reset(const StateBase& init_state, bool expand = true);
     void ApplyRootNoise(double alpha, double eps);
+    // carries over searches of the same position from elsewhere, their
+    // stats are added to the children of the expanded root as if searched
+    // here, actions it does not have are skipped
+    void AddRootStats(const std::vector<ChildStats>& stats);
     Action GetBestAction() const;
     std::vector<ActionInfo> GetActionInfos() const;
+    // mean reward of the root for the side to move, children's q are for
+    // the same side
+    Reward GetRootValue() const;
 
     const Config config;
 
@@ -91,7 +128,8 @@ private:
     void StartThreads();
     void StopThreads();
     void SearchThreadJob(int t_idx);
-    void SingleSearch(StateBase* search_state, int t_idx);
+    void SingleSearch(int remaining);
+    void Backup(Node* cur, Reward z);
     void ExpandRoot();
 
     Node* root;
@@ -0,0 +1,35 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace nn {
+
+
+// C[M, N] = A[M, K] * B[K, N] + bias[M] (+ residual[M, N]), all row-major.
+// bias and residual may be null, relu is applied last.
+void Gemm(
+    int M, int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C);
+
+// Lays out 3x3 patches (padding 1) of input [channels, batch * h * w] as
+// columns of col [channels * 9, batch * h * w].
+void Im2Col3x3(
+    int channels, int batch, int h, int w, const float* input, float* col);
+
+// Softmax over the entries whose mask is zero, masked entries get zero.
+void MaskedSoftmax(int n, const float* logits, const uint8_t* mask, float* probs);
+
+// out[i] = bit i of bits as 1 or 0, for the first n bits.
+void ExpandBits(int n, const uint64_t* bits, float* out);
+void ExpandBits(int n, const uint64_t* bits, uint8_t* out);
+
+// Instruction set the kernels run with, chosen for the cpu at startup.
+const char* KernelIsa();
+
+
+}
+
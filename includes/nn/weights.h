@@ -0,0 +1,52 @@
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace nn {
+
+
+struct Tensor {
+    std::vector<int> shape;
+    std::vector<float> data;
+
+    size_t Numel() const;
+};
+
+
+// Named float32 tensors stored as
+//   magic, version, count, 
+//   count * (name length, name, ndim, dims[ndim], data[numel])
+// with every integer a little-endian uint32/int32.
+class WeightFile {
+public:
+    const static uint32_t MAGIC = 0x574b4d47;
+    const static uint32_t VERSION = 1;
+
+public:
+    WeightFile() = default;
+    WeightFile(const std::string& path);
+
+    void Load(const std::string& path);
+    void Save(const std::string& path) const;
+
+    bool Has(const std::string& name) const;
+    const Tensor& Get(const std::string& name) const;
+    const Tensor& Get(const std::string& name, const std::vector<int>& shape) const;
+    void Put(const std::string& name, Tensor tensor);
+
+    inline const std::map<std::string, Tensor>& Tensors() const {
+        return tensors;
+    }
+
+private:
+    std::map<std::string, Tensor> tensors;
+};
+
+
+}
+
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include <fmt/format.h>
+#include "gomoku/exporter.h"
+
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+
+
+int main(int argc, char *argv[]) {
+    std::vector<fs::path> inputs;
+    fs::path out_path;
+    gomoku::logger::DatasetExporter::Config config;
+
+    po::options_description desc("export dataset config");
+    desc.add_options()
+        ("help,h", "usage")
+        (
+            "input",
+            po::value<std::vector<fs::path>>(&inputs)->multitoken()
+                ->required(),
+            "game logs or shards, directories are searched for .bin files"
+        )
+        (
+            "out_path",
+            po::value<fs::path>(&out_path)->required(),
+            "dataset file to write"
+        )
+        (
+            "n_threads",
+            po::value<size_t>(&config.n_threads)->default_value(0),
+            "number of threads replaying games, 0 for one per core"
+        )
+        (
+            "augment",
+            po::bool_switch(&config.augment),
+            "write every position in all 8 board symmetries"
+        )
+    ;
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+            .options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    try {
+        gomoku::logger::LogReader reader(inputs);
+        std::cout << fmt::format("{} games, {} positions in {} files",
+            reader.NumGames(), reader.NumPositions(), reader.NumFiles())
+            << std::endl;
+
+        gomoku::logger::DatasetExporter exporter(config);
+        std::chrono::steady_clock::time_point st
+            = std::chrono::steady_clock::now();
+        size_t n = exporter.Export(reader, out_path);
+        double sec = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - st).count();
+        std::cout << fmt::format("exported {} positions to {} in {:.2f} sec",
+            n, out_path.string(), sec) << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
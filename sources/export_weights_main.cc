@@ -0,0 +1,183 @@
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <limits>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include <torch/script.h>
+#include <fmt/format.h>
+#include "nn/weights.h"
+#include "gomoku/board.h"
+#include "gomoku/torch_evaluator.h"
+#include "gomoku/native_evaluator.h"
+
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+
+
+nn::Tensor ToHost(const torch::Tensor& tensor) {
+    torch::Tensor t = tensor.to(torch::kCPU, torch::kFloat32).contiguous();
+    nn::Tensor ret;
+    for (int64_t dim: t.sizes())
+        ret.shape.push_back((int)dim);
+    ret.data.assign(t.data_ptr<float>(), t.data_ptr<float>() + t.numel());
+    return ret;
+}
+
+
+std::string Rename(
+    const std::string& name, const std::vector<std::string>& mappings) {
+    for (const std::string& mapping: mappings) {
+        size_t eq = mapping.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("mapping " + mapping + " is not from=to");
+        std::string from = mapping.substr(0, eq);
+        if (name.rfind(from, 0) == 0)
+            return mapping.substr(eq + 1) + name.substr(from.size());
+    }
+    return name;
+}
+
+
+std::vector<gomoku::Input> RandomInputs(int n) {
+    std::mt19937 gen(0);
+    std::vector<gomoku::Input> ret;
+    while (ret.size() < n) {
+        gomoku::Board board;
+        int n_moves = std::uniform_int_distribution<int>(1, 60)(gen);
+        for (int i = 0; i < n_moves && !board.Terminated(); i++) {
+            mcts::Action action;
+            do {
+                action = std::uniform_int_distribution<int>(
+                    0, gomoku::SIZE * gomoku::SIZE - 1)(gen);
+            } while (board.GetDataPtr()[action] == 0);
+            board.Play(action);
+        }
+        if (!board.Terminated())
+            ret.push_back(gomoku::GomokuEvaluator::Preprocess(board));
+    }
+    return ret;
+}
+
+
+int CheckParity(
+    torch::jit::script::Module&& model, const nn::WeightFile& weights, 
+    int n_positions, double tolerance) {
+    gomoku::GomokuEvaluator::Config cfg;
+    gomoku::TorchEvaluator reference(
+        std::move(model), torch::Device(torch::kCPU), cfg);
+    cfg.backend = gomoku::GomokuEvaluator::Backend::NATIVE;
+    gomoku::NativeEvaluator native(weights, cfg);
+
+    std::vector<gomoku::Input> inputs = RandomInputs(n_positions);
+    std::vector<gomoku::Output> expected = reference.EvaluateBatch(inputs);
+    std::vector<gomoku::Output> actual = native.EvaluateBatch(inputs);
+
+    double value_diff = 0, policy_diff = 0;
+    for (int i = 0; i < n_positions; i++) {
+        value_diff = std::max<double>(
+            value_diff, std::abs(expected[i].first - actual[i].first));
+        if (expected[i].second.size() != actual[i].second.size()) {
+            policy_diff = std::numeric_limits<double>::infinity();
+            continue;
+        }
+        for (int a = 0; a < expected[i].second.size(); a++) {
+            if (expected[i].second[a].first != actual[i].second[a].first)
+                policy_diff = std::numeric_limits<double>::infinity();
+            policy_diff = std::max<double>(policy_diff, std::abs(
+                expected[i].second[a].second - actual[i].second[a].second));
+        }
+    }
+    std::cout << fmt::format(
+        "parity over {} positions: max value diff {:.3e}, max policy diff {:.3e}",
+        n_positions, value_diff, policy_diff) << std::endl;
+    return (value_diff > tolerance || policy_diff > tolerance) ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    fs::path model_path, out_path;
+    std::vector<std::string> mappings;
+    bool check = false;
+    int n_positions;
+    double tolerance;
+
+    po::options_description desc("export weights config");
+    desc.add_options()
+        ("help,h", "usage")
+        (
+            "model_path", 
+            po::value<fs::path>(&model_path)->required(), 
+            "torch jit module path"
+        )
+        (
+            "out_path", 
+            po::value<fs::path>(&out_path)->required(), 
+            "weight file path for the native backend"
+        )
+        (
+            "map", 
+            po::value<std::vector<std::string>>(&mappings)->multitoken(),
+            "parameter name prefix mappings as from=to"
+        )
+        (
+            "check_parity", 
+            po::bool_switch(&check),
+            "compare the native backend against libtorch after exporting"
+        )
+        (
+            "n_positions", 
+            po::value<int>(&n_positions)->default_value(256),
+            "number of random positions for the parity check"
+        )
+        (
+            "tolerance", 
+            po::value<double>(&tolerance)->default_value(1e-3),
+            "maximum absolute difference allowed by the parity check"
+        )
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    try {
+        torch::jit::script::Module model(torch::jit::load(model_path));
+        model.eval();
+
+        nn::WeightFile weights;
+        for (const auto& param: model.named_parameters(true)) {
+            weights.Put(Rename(param.name, mappings), ToHost(param.value));
+        }
+        for (const auto& buffer: model.named_buffers(true)) {
+            if (buffer.name.ends_with("num_batches_tracked"))
+                continue;
+            weights.Put(Rename(buffer.name, mappings), ToHost(buffer.value));
+        }
+        weights.Save(out_path);
+        std::cout << fmt::format("exported {} tensors to {}", 
+            weights.Tensors().size(), out_path.string()) << std::endl;
+
+        if (check)
+            return CheckParity(std::move(model), weights, n_positions, tolerance);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
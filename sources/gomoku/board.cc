@@ -2,6 +2,7 @@
 #include <string>
 #include <iomanip>
 #include <exception>
+#include <algorithm>
 #include <fmt/format.h>
 #include <boost/functional/hash.hpp>
 #include "gomoku/board.h"
@@ -14,6 +15,12 @@ Board::Board() {
 }
 
 
+Board::Board(int candidate_dist_)
+: candidate_dist(std::clamp(candidate_dist_, 0, MAX_CANDIDATE_DIST)) {
+    Reset();
+}
+
+
 // Board::Board(const Board& b): turn(b.turn), state(b.state), 
 // turn_elapsed(b.turn_elapsed), last_action(b.last_action) {
 //     for (int r = 0; r < SIZE; r++) {
@@ -65,6 +72,31 @@ void Board::Reset() {
             board[WHITE][r][c] = 0;
         }
     }
+    occupied.reset();
+    candidates.set();
+}
+
+
+const Board::Bitset& Board::Neighborhood(mcts::Action action, int dist) {
+    using Table = std::vector<Bitset>;
+    static const std::vector<Table> tables = [] {
+        std::vector<Table> ret(MAX_CANDIDATE_DIST + 1, Table(SIZE * SIZE));
+        for (int d = 0; d <= MAX_CANDIDATE_DIST; d++) {
+            for (int r = 0; r < SIZE; r++) {
+                for (int c = 0; c < SIZE; c++) {
+                    Bitset& mask = ret[d][Coord2Action(r, c)];
+                    for (int nr = r - d; nr <= r + d; nr++) {
+                        for (int nc = c - d; nc <= c + d; nc++) {
+                            if (Inside(nr, nc))
+                                mask.set(Coord2Action(nr, nc));
+                        }
+                    }
+                }
+            }
+        }
+        return ret;
+    }();
+    return tables[dist][action];
 }
 
 
@@ -91,6 +123,14 @@ void Board::Play(mcts::Action action) {
     board[EMPTY][pos.r][pos.c] = 0;
     board[turn][pos.r][pos.c] = 1;
 
+    occupied.set(action);
+    if (candidate_dist > 0) {
+        if (turn_elapsed == 0)
+            candidates.reset();
+        candidates |= Neighborhood(action, candidate_dist) & ~occupied;
+    }
+    candidates.reset(action);
+
     if (turn == BLACK) {
         turn = WHITE;
         black_hsum += seed;
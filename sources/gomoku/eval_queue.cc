@@ -1,11 +1,20 @@
 
+#include <chrono>
 #include <exception>
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <fmt/format.h>
 #include "gomoku/eval_queue.h"
 
 
 namespace gomoku {
 
+
+thread_local std::mt19937 gen(std::random_device{}());
+
+
 /*
 EvaluationQueue::EvaluationQueue(GomokuEvaluator&& evaluator_)
 : evaluator(evaluator_) {
@@ -49,91 +58,519 @@ Evaluation EvaluationQueue::Evaluate(const mcts::StateBase* state) {
 */
 
 
-EvaluationQueue::EvaluationQueue(EvaluationQueue::Evaluator evaluator) {
+EvaluationQueue::EvaluationQueue(EvaluationQueue::Evaluator evaluator)
+: EvaluationQueue::EvaluationQueue(std::move(evaluator), Config()) {}
+
+
+EvaluationQueue::EvaluationQueue
+(EvaluationQueue::Evaluator evaluator, EvaluationQueue::Config conf)
+: config(conf), ring(conf.capacity) {
+    if (config.max_batch == 0)
+        throw std::runtime_error("EvaluationQueue max_batch must be positive");
     running = true;
-    eval_threads.emplace_back(
-        &EvaluationQueue::EvaluationThread, this, std::move(evaluator));
+    StartPipeline(std::move(evaluator), 0);
 }
 
 
 EvaluationQueue::EvaluationQueue
-(std::vector<EvaluationQueue::Evaluator> evaluators) {
+(std::vector<EvaluationQueue::Evaluator> evaluators)
+: EvaluationQueue::EvaluationQueue(std::move(evaluators), Config()) {}
+
+
+EvaluationQueue::EvaluationQueue
+(std::vector<EvaluationQueue::Evaluator> evaluators, 
+ EvaluationQueue::Config conf, int generation)
+: config(conf), ring(conf.capacity) {
     if (evaluators.empty()) {
         throw std::runtime_error("EvaluationQueue has no GomokuEvaluators");
     }
+    if (config.max_batch == 0)
+        throw std::runtime_error("EvaluationQueue max_batch must be positive");
     running = true;
     for (EvaluationQueue::Evaluator& evaluator: evaluators) {
-        eval_threads.emplace_back(
-            &EvaluationQueue::EvaluationThread, this, std::move(evaluator));
+        StartPipeline(std::move(evaluator), generation);
     }
 }
 
 
 
 EvaluationQueue::~EvaluationQueue() {
+    running.store(false);
+    pending.fetch_add(1);
+    pending.notify_all();
     {
-        std::unique_lock<std::mutex> lock(m_q);
-        running = false;
+        std::unique_lock<std::mutex> lock(m_pending);
+        cv_pending.notify_all();
     }
-    cv_q.notify_one();
-    for (auto& thread: eval_threads) {
-        thread.join();
+    for (auto& pipeline: pipelines) {
+        pipeline->assemble_thread.join();
+        pipeline->forward_thread.join();
+        pipeline->scatter_thread.join();
     }
 }
 
 
-Evaluation EvaluationQueue::Evaluate(const mcts::StateBase* state) {
+Evaluation EvaluationQueue::Evaluate(
+    const mcts::StateBase* state, const mcts::EvalHint& hint) {
     const Board& board = dynamic_cast<const Board&>(*state);
+    uint32_t priority = Priority(hint);
     // std::size_t hash = board.Hash();
     // {
     //     std::unique_lock<std::mutex> lock(m_s);
     //     hashes.insert(hash);
     // }
-    Input input = GomokuEvaluator::Preprocess(board);
+    if (config.symmetry == Symmetry::ENSEMBLE) {
+        // all transforms are pushed together so they land in one batch
+        Request requests[N_SYMMETRIES];
+        std::vector<int> syms(N_SYMMETRIES);
+        for (int sym = 0; sym < N_SYMMETRIES; sym++) {
+            syms[sym] = sym;
+            requests[sym].input = GomokuEvaluator::Preprocess(board, sym);
+            requests[sym].priority = priority;
+        }
+        Submit(requests, N_SYMMETRIES);
+        std::vector<Output> outputs;
+        for (Request& request: requests) {
+            WaitDone(request);
+            outputs.push_back(std::move(request.output));
+        }
+        return GomokuEvaluator::Postprocess(std::move(outputs), board, syms);
+    }
 
-    std::promise<Output> p;
-    std::future<Output> f(p.get_future());
-    {
-        std::unique_lock<std::mutex> lock(m_q);
-        q.push({std::move(input), &p});
+    int sym = 0;
+    if (config.symmetry == Symmetry::RANDOM) {
+        sym = std::uniform_int_distribution<int>(0, N_SYMMETRIES - 1)(gen);
     }
-    cv_q.notify_one();
+    Request request;
+    request.input = GomokuEvaluator::Preprocess(board, sym);
+    request.priority = priority;
+    Submit(&request, 1);
+    WaitDone(request);
 
-    Output output = f.get();
-    Evaluation evaluation = GomokuEvaluator::Postprocess(std::move(output), board);
+    Evaluation evaluation 
+        = GomokuEvaluator::Postprocess(std::move(request.output), board, sym);
     return evaluation;
 }
 
 
-void EvaluationQueue::EvaluationThread(EvaluationQueue::Evaluator evaluator) {
-    // printf("eval thread started");
+std::vector<Evaluation> EvaluationQueue::EvaluateBatch(
+    const std::vector<const mcts::StateBase*>& states, 
+    const std::vector<mcts::EvalHint>& hints) {
+    std::vector<const Board*> boards;
+    std::vector<std::vector<int>> syms(states.size());
+    size_t n = 0;
+    for (size_t i = 0; i < states.size(); i++) {
+        boards.push_back(&dynamic_cast<const Board&>(*states[i]));
+        if (config.symmetry == Symmetry::ENSEMBLE) {
+            for (int sym = 0; sym < N_SYMMETRIES; sym++) {
+                syms[i].push_back(sym);
+            }
+        }
+        else if (config.symmetry == Symmetry::RANDOM) {
+            syms[i].push_back(
+                std::uniform_int_distribution<int>(0, N_SYMMETRIES - 1)(gen));
+        }
+        else {
+            syms[i].push_back(0);
+        }
+        n += syms[i].size();
+    }
+
+    std::unique_ptr<Request[]> requests = std::make_unique<Request[]>(n);
+    size_t offset = 0;
+    for (size_t i = 0; i < states.size(); i++) {
+        uint32_t priority = Priority(hints[i]);
+        for (int sym: syms[i]) {
+            requests[offset].input = GomokuEvaluator::Preprocess(*boards[i], sym);
+            requests[offset].priority = priority;
+            offset++;
+        }
+    }
+    Submit(requests.get(), n);
+
+    std::vector<Evaluation> ret;
+    offset = 0;
+    for (size_t i = 0; i < states.size(); i++) {
+        std::vector<Output> outputs;
+        for (size_t j = 0; j < syms[i].size(); j++, offset++) {
+            WaitDone(requests[offset]);
+            outputs.push_back(std::move(requests[offset].output));
+        }
+        if (outputs.size() == 1)
+            ret.push_back(GomokuEvaluator::Postprocess(
+                std::move(outputs.front()), *boards[i], syms[i][0]));
+        else
+            ret.push_back(GomokuEvaluator::Postprocess(
+                std::move(outputs), *boards[i], syms[i]));
+    }
+    return ret;
+}
+
+
+uint32_t EvaluationQueue::Priority(const mcts::EvalHint& hint) {
+    // searches closest to done go first, and within one search the
+    // shallow requests, a root expansion blocks the whole game
+    uint32_t remaining = std::max(hint.remaining, 0);
+    uint32_t depth = std::clamp(hint.depth, 0, 255);
+    return (std::min<uint32_t>(remaining, 0xffffff) << 8) | depth;
+}
+
+
+std::atomic<uint32_t>& EvaluationQueue::WakeWord(const Request* request) {
+    return wake_words[((uintptr_t)request >> 6) % WAKE_WORDS];
+}
+
+
+void EvaluationQueue::WaitDone(const EvaluationQueue::Request& request) {
+    std::atomic<uint32_t>& word = WakeWord(&request);
     while (true) {
-        std::vector<Input> inputs;
-        std::vector<std::promise<Output>*> promises;
-        {
-            std::unique_lock<std::mutex> lock(m_q);
-            cv_q.wait(lock, [&] {
-                return !running || !q.empty();
-            });
-            if (!running)
-                break;
-            while (!q.empty()) {
-                inputs.push_back(std::move(q.front().first));
-                promises.push_back(q.front().second);
-                q.pop();
+        uint32_t seq = word.load(std::memory_order_acquire);
+        if (request.done.load(std::memory_order_acquire))
+            return;
+        word.wait(seq, std::memory_order_acquire);
+    }
+}
+
+
+void EvaluationQueue::Submit(EvaluationQueue::Request* requests, int n) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int published = 0;
+    for (int i = 0; i < n; i++) {
+        requests[i].enqueued = now;
+        while (!ring.TryPush(requests + i)) {
+            // a batch larger than the ring is only drained once the
+            // requests already pushed are announced
+            if (published < i) {
+                pending.fetch_add(i - published);
+                pending.notify_one();
+                published = i;
+                if (collect_waiting.load()) {
+                    std::unique_lock<std::mutex> lock(m_pending);
+                    cv_pending.notify_one();
+                }
             }
+            std::this_thread::yield();
         }
-        if (!inputs.empty()) {
-            std::vector<Output> results = evaluator->EvaluateBatch(inputs);
-            for (int i = 0; i < results.size(); i++) {
-                promises[i]->set_value(std::move(results[i]));
+    }
+    pending.fetch_add(n - published);
+    pending.notify_one();
+    if (collect_waiting.load()) {
+        std::unique_lock<std::mutex> lock(m_pending);
+        cv_pending.notify_one();
+    }
+}
+
+
+void EvaluationQueue::Reload(
+    std::vector<EvaluationQueue::Evaluator> evaluators, int generation) {
+    if (evaluators.size() != pipelines.size()) {
+        throw std::runtime_error(fmt::format(
+            "EvaluationQueue reload with {} evaluators for {} pipelines", 
+            evaluators.size(), pipelines.size()));
+    }
+    for (int i = 0; i < pipelines.size(); i++) {
+        std::unique_lock<std::mutex> lock(pipelines[i]->m_staged);
+        pipelines[i]->staged = std::move(evaluators[i]);
+        pipelines[i]->staged_generation = generation;
+    }
+}
+
+
+int EvaluationQueue::Generation() const {
+    int generation = pipelines.front()->generation.load();
+    for (const auto& pipeline: pipelines) {
+        generation = std::min(generation, pipeline->generation.load());
+    }
+    return generation;
+}
+
+
+void EvaluationQueue::StartPipeline(
+    EvaluationQueue::Evaluator evaluator, int generation) {
+    std::unique_ptr<Pipeline> pipeline = std::make_unique<Pipeline>();
+    pipeline->evaluator = std::move(evaluator);
+    pipeline->generation = generation;
+    for (int slot = 0; slot < PIPELINE_SLOTS; slot++) {
+        pipeline->requests[slot].reserve(config.max_batch);
+        pipeline->free.Push(slot);
+    }
+    Pipeline& p = *pipeline;
+    p.assemble_thread = std::thread(
+        &EvaluationQueue::AssembleThread, this, std::ref(p));
+    p.forward_thread = std::thread(
+        &EvaluationQueue::ForwardThread, this, std::ref(p));
+    p.scatter_thread = std::thread(
+        &EvaluationQueue::ScatterThread, this, std::ref(p));
+    pipelines.push_back(std::move(pipeline));
+}
+
+
+void EvaluationQueue::AssembleThread(EvaluationQueue::Pipeline& pipeline) {
+    int slot;
+    while (pipeline.free.Pop(slot)) {
+        std::vector<Request*>& requests = pipeline.requests[slot];
+        if (!CollectBatch(requests))
+            break;
+        Batch& batch = pipeline.batches[slot];
+        batch.Clear();
+        for (Request* request: requests) {
+            batch.Push(request->input);
+        }
+        batch.Expand();
+        pipeline.filled.Push(slot);
+    }
+    pipeline.filled.Close();
+}
+
+
+void EvaluationQueue::ForwardThread(EvaluationQueue::Pipeline& pipeline) {
+    // printf("eval thread started");
+    pipeline.evaluator->BindThread();
+    int slot;
+    while (pipeline.filled.Pop(slot)) {
+        {
+            std::unique_lock<std::mutex> lock(pipeline.m_staged);
+            if (pipeline.staged) {
+                pipeline.evaluator = std::move(pipeline.staged);
+                pipeline.generation = pipeline.staged_generation;
+                pipeline.evaluator->BindThread();
             }
         }
+        pipeline.forwarded[slot] = pipeline.evaluator;
+        pipeline.evaluator->Forward(pipeline.batches[slot]);
+        pipeline.inferred.Push(slot);
     }
+    pipeline.inferred.Close();
     // printf("eval thread stop");
 }
 
 
+void EvaluationQueue::ScatterThread(EvaluationQueue::Pipeline& pipeline) {
+    int slot;
+    while (pipeline.inferred.Pop(slot)) {
+        std::vector<Request*>& requests = pipeline.requests[slot];
+        for (int i = 0; i < requests.size(); i++) {
+            requests[i]->output 
+                = pipeline.forwarded[slot]->Unpack(pipeline.batches[slot], i);
+            // the waiter may return and free the request once it sees done,
+            // so the wakeup goes to a word of the queue instead
+            std::atomic<uint32_t>& word = WakeWord(requests[i]);
+            requests[i]->done.store(1, std::memory_order_release);
+            word.fetch_add(1, std::memory_order_release);
+            word.notify_all();
+        }
+        requests.clear();
+        // the last batch of a replaced replica releases it here
+        pipeline.forwarded[slot].reset();
+        pipeline.free.Push(slot);
+    }
+    pipeline.free.Close();
+}
+
+
+bool EvaluationQueue::CollectBatch(std::vector<Request*>& batch) {
+    // evaluator threads take turns forming batches, so that a single batch
+    // is filled up to the policy before the next thread starts on another
+    // one, instead of all threads splitting the ring into small pieces
+    std::unique_lock<std::mutex> collect_lock(m_collect);
+    while (backlog.empty()) {
+        if (!running.load())
+            return false;
+        int n_pending = pending.load(std::memory_order_acquire);
+        if (n_pending > 0)
+            break;
+        pending.wait(n_pending, std::memory_order_acquire);
+    }
+
+    std::chrono::steady_clock::time_point deadline 
+        = std::chrono::steady_clock::now() 
+        + std::chrono::microseconds(config.max_wait_us);
+    Request* request;
+    while (true) {
+        int n_popped = 0;
+        while (backlog.size() < config.capacity && ring.TryPop(request)) {
+            backlog.push_back(request);
+            n_popped++;
+        }
+        pending.fetch_sub(n_popped, std::memory_order_relaxed);
+        if (!running.load())
+            return false;
+        if (backlog.size() >= config.max_batch)
+            break;
+        if (!backlog.empty() && (backlog.size() >= config.min_batch 
+                || std::chrono::steady_clock::now() >= deadline))
+            break;
+        // sleeps until more requests are pushed or the deadline passes
+        std::unique_lock<std::mutex> lock(m_pending);
+        collect_waiting.store(true);
+        cv_pending.wait_until(lock, deadline, [&] {
+            return pending.load() > 0 || !running.load();
+        });
+        collect_waiting.store(false);
+    }
+    SelectBatch(batch);
+    return true;
+}
+
+
+void EvaluationQueue::SelectBatch(std::vector<Request*>& batch) {
+    size_t batch_size = std::min(backlog.size(), config.max_batch);
+    if (!config.priority || batch_size == backlog.size()) {
+        batch.insert(batch.end(), backlog.begin(), backlog.begin() + batch_size);
+        backlog.erase(backlog.begin(), backlog.begin() + batch_size);
+        return;
+    }
+
+    // requests waiting longer than max_age_us go first, oldest first, so
+    // that low priority requests are delayed but never starved
+    std::chrono::steady_clock::time_point old 
+        = std::chrono::steady_clock::now() 
+        - std::chrono::microseconds(config.max_age_us);
+    auto starving = std::partition(backlog.begin(), backlog.end(), 
+        [&](const Request* r) {
+            return r->enqueued <= old;
+        });
+    std::sort(backlog.begin(), starving, 
+        [](const Request* a, const Request* b) {
+            return a->enqueued < b->enqueued;
+        });
+    if (starving - backlog.begin() < batch_size) {
+        std::partial_sort(starving, backlog.begin() + batch_size, backlog.end(), 
+            [](const Request* a, const Request* b) {
+                return a->priority < b->priority;
+            });
+    }
+    batch.insert(batch.end(), backlog.begin(), backlog.begin() + batch_size);
+    backlog.erase(backlog.begin(), backlog.begin() + batch_size);
+}
+
+
+void EvaluationQueue::SlotQueue::Push(int slot) {
+    {
+        std::unique_lock<std::mutex> lock(m);
+        slots.push_back(slot);
+    }
+    cv.notify_one();
+}
+
+
+bool EvaluationQueue::SlotQueue::Pop(int& slot) {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] {
+        return closed || !slots.empty();
+    });
+    if (slots.empty())
+        return false;
+    slot = slots.front();
+    slots.pop_front();
+    return true;
+}
+
+
+void EvaluationQueue::SlotQueue::Close() {
+    {
+        std::unique_lock<std::mutex> lock(m);
+        closed = true;
+    }
+    cv.notify_all();
+}
+
+
+std::ostream& operator<<(std::ostream& out, EvaluationQueue::Symmetry symmetry) {
+    switch (symmetry) {
+    case EvaluationQueue::Symmetry::NONE:
+        return out << "none";
+    case EvaluationQueue::Symmetry::RANDOM:
+        return out << "random";
+    case EvaluationQueue::Symmetry::ENSEMBLE:
+        return out << "ensemble";
+    }
+    return out << "unknown";
+}
+
+
+std::istream& operator>>(std::istream& in, EvaluationQueue::Symmetry& symmetry) {
+    std::string token;
+    in >> token;
+    if (token == "none")
+        symmetry = EvaluationQueue::Symmetry::NONE;
+    else if (token == "random")
+        symmetry = EvaluationQueue::Symmetry::RANDOM;
+    else if (token == "ensemble")
+        symmetry = EvaluationQueue::Symmetry::ENSEMBLE;
+    else
+        in.setstate(std::ios::failbit);
+    return in;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const EvaluationQueue::Config& cfg) {
+    out << "EvaluationQueue::Config(" << "\n    ";
+    out << "max_batch: " << cfg.max_batch << "\n    ";
+    out << "min_batch: " << cfg.min_batch << "\n    ";
+    out << "max_wait_us: " << cfg.max_wait_us << "\n    ";
+    out << "capacity: " << cfg.capacity << "\n    ";
+    out << "symmetry: " << cfg.symmetry << "\n    ";
+    out << "priority: " << cfg.priority << "\n    ";
+    out << "max_age_us: " << cfg.max_age_us;
+    out << ")";
+    return out;
+}
+
+
+boost::program_options::options_description
+GetEvaluationQueueConfig(EvaluationQueue::Config& cfg) {
+    boost::program_options::options_description desc("Evaluation queue config");
+    desc.add_options()
+        (
+            "max_batch", 
+            boost::program_options::value<size_t>(&cfg.max_batch)
+                ->default_value(256),
+            "maximum number of positions in a single evaluation batch"
+        )
+        (
+            "min_batch", 
+            boost::program_options::value<size_t>(&cfg.min_batch)
+                ->default_value(1),
+            "number of positions a batch waits for before being evaluated"
+        )
+        (
+            "max_wait_us", 
+            boost::program_options::value<int64_t>(&cfg.max_wait_us)
+                ->default_value(0),
+            "maximum microseconds to wait for min_batch positions"
+        )
+        (
+            "queue_capacity", 
+            boost::program_options::value<size_t>(&cfg.capacity)
+                ->default_value(4096),
+            "number of request slots in the evaluation ring"
+        )
+        (
+            "symmetry", 
+            boost::program_options::value<EvaluationQueue::Symmetry>
+                (&cfg.symmetry)->default_value(
+                    EvaluationQueue::Symmetry::NONE, "none"),
+            "board transform per evaluation, one of none, random or ensemble "
+            "(average of all 8)"
+        )
+        (
+            "priority", 
+            boost::program_options::bool_switch(&cfg.priority),
+            "batch requests of searches closest to completion first"
+        )
+        (
+            "max_age_us", 
+            boost::program_options::value<int64_t>(&cfg.max_age_us)
+                ->default_value(5000),
+            "microseconds after which a request is batched regardless of "
+            "priority"
+        )
+    ;
+    return desc;
+}
+
+
 }
 
 
@@ -1,100 +1,162 @@
 
+
+#include <chrono>
+#include <string>
 #include <algorithm>
-#include <torch/torch.h>
+#include <fmt/format.h>
+#include "nn/kernels.h"
 #include "gomoku/evaluator.h"
 
 
 namespace gomoku {
 
 
-GomokuEvaluator::GomokuEvaluator(torch::jit::script::Module&& model_)
-: model(std::move(model_)), device(torch::kCPU) {
-    if (torch::cuda::is_available()) {
-        device = torch::Device(torch::kCUDA);
+GomokuEvaluator::GomokuEvaluator(GomokuEvaluator::Config conf)
+: config(conf) {}
+
+
+void GomokuEvaluator::BindThread() const {}
+
+
+void Batch::Clear() {
+    size = 0;
+    inputs.clear();
+    states.clear();
+    turns.clear();
+    masks.clear();
+    k = 0;
+    values.clear();
+    probs.clear();
+    actions.clear();
+}
+
+
+void Batch::Push(const Input& input) {
+    inputs.push_back(input);
+    turns.push_back(input.turn);
+    size++;
+}
+
+
+void Batch::Expand() {
+    const int flat = SIZE * SIZE;
+    states.resize(size * Input::PLANES * flat);
+    masks.resize(size * flat);
+    for (int b = 0; b < size; b++) {
+        // planes are ordered as (empty, own stones, opponent stones, black turn)
+        const Input& input = inputs[b];
+        uint64_t empty[Input::WORDS];
+        for (int w = 0; w < Input::WORDS; w++)
+            empty[w] = ~(input.own[w] | input.opp[w]);
+        float* state = states.data() + b * Input::PLANES * flat;
+        nn::ExpandBits(flat, empty, state);
+        nn::ExpandBits(flat, input.own, state + flat);
+        nn::ExpandBits(flat, input.opp, state + 2 * flat);
+        std::fill(state + 3 * flat, state + 4 * flat, 
+                  (input.turn == 0) ? 1.f : 0.f);
+        nn::ExpandBits(flat, input.masked, masks.data() + b * flat);
     }
-    model.eval();
-    model.to(device);
 }
 
 
-GomokuEvaluator::GomokuEvaluator
-(torch::jit::script::Module&& model_, torch::Device device_)
-: model(std::move(model_)), device(device) {
-    model.eval();
-    model.to(device);
+Output GomokuEvaluator::Unpack(const Batch& batch, int idx) const {
+    const uint8_t* mask = batch.masks.data() + idx * SIZE * SIZE;
+    const float* probs = batch.probs.data() + idx * batch.k;
+    if (batch.actions.empty()) {
+        return Output(batch.values[idx], SelectPolicy(probs, mask));
+    }
+
+    // backend already selected the top k, sorted by probability
+    const int64_t* actions = batch.actions.data() + idx * batch.k;
+    Policy policy;
+    for (int j = 0; j < batch.k; j++) {
+        if (!mask[actions[j]])
+            policy.emplace_back((Action)actions[j], (Prob)probs[j]);
+    }
+    TruncatePolicy(policy);
+    return Output(batch.values[idx], std::move(policy));
 }
 
 
 std::vector<Output> GomokuEvaluator::EvaluateBatch(std::vector<Input>& inputs) {
-    torch::NoGradGuard();
-    int size = inputs.size();
-    std::vector<torch::Tensor> states, turns, masks;
-
-    for (Input& input: inputs) {
-        states.push_back(std::move(input.state));
-        turns.push_back(std::move(input.turn));
-        masks.push_back(std::move(input.mask));
-    }
-    
-    torch::Tensor input_tensor = torch::stack(std::move(states)).to(device);
-    torch::Tensor turn_tensor = torch::concatenate(std::move(turns)).to(device);
-    torch::Tensor mask_tensor = torch::stack(std::move(masks)).to(device);
-
-    std::vector<torch::jit::IValue> batch;
-    batch.push_back(std::move(input_tensor));
-    batch.push_back(std::move(turn_tensor));
-
-    torch::jit::IValue out = model.forward(batch);
-    torch::Tensor probs = out.toTuple()->elements()[0].toTensor();
-    torch::Tensor results = out.toTuple()->elements()[1].toTensor();
-
-    probs = torch::masked_fill(probs, mask_tensor, -1e+9);
-    probs = torch::nn::functional::softmax(probs, 1);
-    probs = probs.to(torch::kCPU);
-    results = results.to(torch::kCPU);
-
-    float* results_ptr = results.data_ptr<float>();
+    Batch batch;
+    for (const Input& input: inputs)
+        batch.Push(input);
+    batch.Expand();
+    Forward(batch);
     std::vector<Output> ret;
-    for (int i = 0; i < size; i++) {
-        ret.emplace_back(results_ptr[i], probs.index({i}));
-    }
+    for (int i = 0; i < batch.size; i++)
+        ret.push_back(Unpack(batch, i));
     return ret;
 }
 
 
+void GomokuEvaluator::Benchmark(
+    const std::vector<int>& batch_sizes, int iters, std::ostream& out) {
+    BindThread();
+    Board board;
+    board.Play(SIZE / 2, SIZE / 2);
+
+    for (int batch_size: batch_sizes) {
+        if (batch_size <= 0)
+            continue;
+        double total_sec = 0;
+        // the first pass is excluded, it includes graph specialization
+        for (int it = 0; it <= iters; it++) {
+            std::vector<Input> inputs;
+            for (int i = 0; i < batch_size; i++) {
+                inputs.push_back(Preprocess(board));
+            }
+            std::chrono::steady_clock::time_point st 
+                = std::chrono::steady_clock::now();
+            EvaluateBatch(inputs);
+            std::chrono::steady_clock::time_point ed 
+                = std::chrono::steady_clock::now();
+            if (it > 0)
+                total_sec += std::chrono::duration<double>(ed - st).count();
+        }
+        double batch_ms = total_sec * 1e+3 / std::max(iters, 1);
+        out << fmt::format(
+            "batch {:>4}: {:8.3f} ms/batch, {:8.1f} us/position",
+            batch_size, batch_ms, batch_ms * 1e+3 / batch_size) << std::endl;
+    }
+}
+
+
 Input GomokuEvaluator::Preprocess(const Board& board) {
-    torch::NoGradGuard();
-    torch::Tensor state = torch::from_blob(
-        (void*)board.GetDataPtr(),
-        {3, SIZE, SIZE},
-        torch::TensorOptions().dtype(torch::kInt8)
-    ).to(torch::kFloat32);
-    torch::Tensor color_plane;
-    if (board.GetTurn() == BLACK) {
-        color_plane = torch::ones(
-            {1, SIZE, SIZE}, torch::TensorOptions().dtype(torch::kFloat32));
+    return Preprocess(board, 0);
+}
+
+
+Input GomokuEvaluator::Preprocess(const Board& board, int sym) {
+    const int8_t* data = board.GetDataPtr();
+    const int flat = SIZE * SIZE;
+    const int8_t* own = data + ((board.GetTurn() == BLACK) ? BLACK : WHITE) * flat;
+    const int8_t* opp = data + ((board.GetTurn() == BLACK) ? WHITE : BLACK) * flat;
+
+    Input ret = {};
+    for (int i = 0; i < flat; i++) {
+        int j = (sym == 0) ? i : Coord2Action(Transform(Action2Coord(i), sym));
+        uint64_t bit = uint64_t(1) << (j & 63);
+        if (own[i])
+            ret.own[j >> 6] |= bit;
+        if (opp[i])
+            ret.opp[j >> 6] |= bit;
+        if (!board.IsCandidate(i))
+            ret.masked[j >> 6] |= bit;
     }
-    else {
-        color_plane = torch::zeros(
-            {1, SIZE, SIZE}, torch::TensorOptions().dtype(torch::kFloat32));
-        state = state.index({
-            torch::tensor({EMPTY, WHITE, BLACK}), "..."});
-    }
-    Input ret;
-    ret.state = torch::cat({std::move(state), std::move(color_plane)});
-    ret.turn = torch::tensor(
-        {(board.GetTurn() == BLACK) ? 0 : 1}, 
-        torch::TensorOptions().dtype(torch::kInt64));
-    ret.mask = torch::from_blob(
-        (void*)board.GetDataPtr(),
-        {SIZE, SIZE},
-        torch::TensorOptions().dtype(torch::kInt8)
-    ).to(torch::kBool).reshape({SIZE * SIZE});
-    ret.mask = torch::logical_not(ret.mask);
+    ret.turn = (board.GetTurn() == BLACK) ? 0 : 1;
     return ret;
 }
 
+
 Evaluation GomokuEvaluator::Postprocess(Output&& output, const Board& board) {
+    return Postprocess(std::move(output), board, 0);
+}
+
+
+Evaluation GomokuEvaluator::Postprocess
+(Output&& output, const Board& board, int sym) {
     Reward r = std::clamp<double>(output.first, -1, 1);
 
     std::vector<std::pair<Action, Prob>> probs;
@@ -102,12 +164,10 @@ Evaluation GomokuEvaluator::Postprocess(Output&& output, const Board& board) {
         probs.emplace_back(Coord2Action(SIZE / 2, SIZE / 2), 1.);
     }
     else {
-        const int8_t* empty_plane = board.GetDataPtr();
-        float* pred_ptr = output.second.data_ptr<float>();
-        for (int i = 0; i < SIZE*SIZE; i++) {
-            if (empty_plane[i] == 1) {
-                probs.emplace_back((Action)i, (Prob)pred_ptr[i]);
-            }
+        probs = std::move(output.second);
+        if (sym != 0) {
+            for (auto& [action, _]: probs)
+                action = Coord2Action(InverseTransform(Action2Coord(action), sym));
         }
     }
 
@@ -115,4 +175,208 @@ Evaluation GomokuEvaluator::Postprocess(Output&& output, const Board& board) {
 }
 
 
+Evaluation GomokuEvaluator::Postprocess(
+    std::vector<Output>&& outputs, const Board& board, 
+    const std::vector<int>& syms) {
+    // averages the evaluations of several transformed copies of the board,
+    // a move missing from a truncated policy counts as zero probability
+    Reward r = 0;
+    std::vector<Prob> sum(SIZE * SIZE, 0.);
+    for (int i = 0; i < outputs.size(); i++) {
+        Evaluation evaluation 
+            = Postprocess(std::move(outputs[i]), board, syms[i]);
+        r += evaluation.first;
+        for (auto& [action, prob]: evaluation.second)
+            sum[action] += prob;
+    }
+    r /= std::max<size_t>(outputs.size(), 1);
+
+    std::vector<std::pair<Action, Prob>> probs;
+    Prob total = 0;
+    for (int i = 0; i < SIZE * SIZE; i++)
+        total += sum[i];
+    for (int i = 0; i < SIZE * SIZE; i++) {
+        if (sum[i] > 0)
+            probs.emplace_back((Action)i, sum[i] / total);
+    }
+    return Evaluation(r, std::move(probs));
+}
+
+
+bool GomokuEvaluator::SparsePolicy() const {
+    return config.policy_topk > 0 || config.policy_top_p < 1.;
+}
+
+
+Policy GomokuEvaluator::SelectPolicy
+(const float* probs, const uint8_t* mask) const {
+    Policy policy;
+    for (int i = 0; i < SIZE * SIZE; i++) {
+        if (!mask[i])
+            policy.emplace_back((Action)i, (Prob)probs[i]);
+    }
+    if (!SparsePolicy())
+        return policy;
+
+    auto by_prob = [](const std::pair<Action, Prob>& a, 
+                      const std::pair<Action, Prob>& b) {
+        return a.second > b.second;
+    };
+    if (config.policy_topk > 0 && config.policy_topk < policy.size()) {
+        std::partial_sort(policy.begin(), policy.begin() + config.policy_topk, 
+            policy.end(), by_prob);
+        policy.resize(config.policy_topk);
+    }
+    else {
+        std::sort(policy.begin(), policy.end(), by_prob);
+    }
+    TruncatePolicy(policy);
+    return policy;
+}
+
+
+void GomokuEvaluator::TruncatePolicy(Policy& policy) const {
+    // policy is sorted by probability, keep the smallest prefix reaching
+    // top_p of the mass and renormalize what is left
+    Prob cumulative = 0;
+    size_t keep = 0;
+    while (keep < policy.size()) {
+        cumulative += policy[keep++].second;
+        if (cumulative >= config.policy_top_p)
+            break;
+    }
+    policy.resize(keep);
+    if (cumulative > 0) {
+        for (auto& [_, prob]: policy)
+            prob /= cumulative;
+    }
+}
+
+
+std::ostream& operator<<(std::ostream& out, GomokuEvaluator::Backend backend) {
+    switch (backend) {
+    case GomokuEvaluator::Backend::TORCH:
+        return out << "torch";
+    case GomokuEvaluator::Backend::NATIVE:
+        return out << "native";
+    }
+    return out << "unknown";
+}
+
+
+std::istream& operator>>(std::istream& in, GomokuEvaluator::Backend& backend) {
+    std::string token;
+    in >> token;
+    if (token == "torch")
+        backend = GomokuEvaluator::Backend::TORCH;
+    else if (token == "native")
+        backend = GomokuEvaluator::Backend::NATIVE;
+    else
+        in.setstate(std::ios::failbit);
+    return in;
+}
+
+
+std::ostream& operator<<(std::ostream& out, GomokuEvaluator::Precision precision) {
+    switch (precision) {
+    case GomokuEvaluator::Precision::FP32:
+        return out << "fp32";
+    case GomokuEvaluator::Precision::BF16:
+        return out << "bf16";
+    case GomokuEvaluator::Precision::INT8:
+        return out << "int8";
+    }
+    return out << "unknown";
+}
+
+
+std::istream& operator>>(std::istream& in, GomokuEvaluator::Precision& precision) {
+    std::string token;
+    in >> token;
+    if (token == "fp32")
+        precision = GomokuEvaluator::Precision::FP32;
+    else if (token == "bf16")
+        precision = GomokuEvaluator::Precision::BF16;
+    else if (token == "int8")
+        precision = GomokuEvaluator::Precision::INT8;
+    else
+        in.setstate(std::ios::failbit);
+    return in;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const GomokuEvaluator::Config& cfg) {
+    out << "GomokuEvaluator::Config(" << "\n    ";
+    out << "backend: " << cfg.backend << "\n    ";
+    out << "optimize: " << cfg.optimize << "\n    ";
+    out << "save_optimized: " << cfg.save_optimized << "\n    ";
+    out << "intra_threads: " << cfg.intra_threads << "\n    ";
+    out << "inter_threads: " << cfg.inter_threads << "\n    ";
+    out << "precision: " << cfg.precision << "\n    ";
+    out << "policy_topk: " << cfg.policy_topk << "\n    ";
+    out << "policy_top_p: " << cfg.policy_top_p;
+    out << ")";
+    return out;
+}
+
+
+boost::program_options::options_description
+GetEvaluatorConfig(GomokuEvaluator::Config& cfg) {
+    boost::program_options::options_description desc("Evaluator config");
+    desc.add_options()
+        (
+            "backend", 
+            boost::program_options::value<GomokuEvaluator::Backend>
+                (&cfg.backend)->default_value(
+                    GomokuEvaluator::Backend::TORCH, "torch"),
+            "inference backend, torch for a jit module or native for "
+            "an exported weight file"
+        )
+        (
+            "optimize", 
+            boost::program_options::bool_switch(&cfg.optimize),
+            "freeze and optimize the torch jit module for inference"
+        )
+        (
+            "save_optimized", 
+            boost::program_options::bool_switch(&cfg.save_optimized),
+            "with optimize, keep the optimized module next to the checkpoint "
+            "and load it instead on later launches"
+        )
+        (
+            "intra_threads", 
+            boost::program_options::value<int>(&cfg.intra_threads)
+                ->default_value(0),
+            "intra-op threads per evaluator, 0 for libtorch default"
+        )
+        (
+            "inter_threads", 
+            boost::program_options::value<int>(&cfg.inter_threads)
+                ->default_value(0),
+            "inter-op threads of the process, 0 for libtorch default"
+        )
+        (
+            "precision", 
+            boost::program_options::value<GomokuEvaluator::Precision>
+                (&cfg.precision)->default_value(
+                    GomokuEvaluator::Precision::FP32, "fp32"),
+            "inference precision, one of fp32, bf16, int8"
+        )
+        (
+            "policy_topk", 
+            boost::program_options::value<int>(&cfg.policy_topk)
+                ->default_value(0),
+            "keep only the k most probable moves per position, 0 keeps all"
+        )
+        (
+            "policy_top_p", 
+            boost::program_options::value<double>(&cfg.policy_top_p)
+                ->default_value(1.),
+            "keep only the most probable moves covering this probability mass"
+        )
+    ;
+    return desc;
+}
+
+
 }
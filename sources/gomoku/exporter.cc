@@ -0,0 +1,180 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fmt/format.h>
+#include "gomoku/exporter.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+const static uint64_t ALIGN = 64;
+
+
+static uint64_t Align(uint64_t offset) {
+    return (offset + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+
+Input MakeSample(const LogReader& reader, size_t game, int move,
+    const Board& board, int sym, float* policy, float& value, float& weight) {
+    LogReader::Game info = reader.GetGame(game);
+    // the search takes evaluations from the side that just moved, as
+    // Board::TerminalReward
+    value = 0;
+    if (info.result == 1 || info.result == 2)
+        value = ((info.result == 1) == (board.GetTurn() == WHITE)) ? 1.f : -1.f;
+
+    weight = reader.FullSearch(game, move) ? 1.f : 0.f;
+
+    std::fill(policy, policy + SIZE * SIZE, 0.f);
+    int total = 0;
+    for (auto [action, n]: reader.GetVisits(game, move)) {
+        total += n;
+    }
+    if (total == 0) {
+        // the opening move is played without a search, its target is the
+        // move itself
+        mcts::Action played = reader.GetAction(game, move);
+        policy[Coord2Action(Transform(Action2Coord(played), sym))] = 1.f;
+    }
+    else {
+        for (auto [action, n]: reader.GetVisits(game, move)) {
+            policy[Coord2Action(Transform(Action2Coord(action), sym))]
+                = (float)n / total;
+        }
+    }
+    return GomokuEvaluator::Preprocess(board, sym);
+}
+
+
+DatasetExporter::DatasetExporter(const DatasetExporter::Config& conf)
+: config(conf) {}
+
+
+size_t DatasetExporter::Export(
+    const LogReader& reader, const std::filesystem::path& path) const {
+    const int flat = SIZE * SIZE;
+    const int n_syms = config.augment ? N_SYMMETRIES : 1;
+
+    // positions of a game are contiguous, starting after the earlier games
+    std::vector<size_t> first(reader.NumGames() + 1, 0);
+    for (size_t g = 0; g < reader.NumGames(); g++) {
+        first[g + 1] = first[g] + reader.GetGame(g).length * n_syms;
+    }
+    DatasetHeader header;
+    header.n = first.back();
+    header.states = Align(sizeof(DatasetHeader));
+    header.policies = Align(
+        header.states + header.n * Input::PLANES * flat * sizeof(float));
+    header.values = Align(header.policies + header.n * flat * sizeof(float));
+    header.weights = Align(header.values + header.n * sizeof(float));
+    uint64_t total = Align(header.weights + header.n * sizeof(float));
+
+    // written under a temporary name, a reader never maps a partial file
+    std::filesystem::path tmp_path = path.string() + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error(fmt::format(
+            "{}: cannot open: {}", tmp_path.string(), strerror(errno)));
+    if (::ftruncate(fd, total) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format(
+            "{}: cannot resize to {} bytes: {}",
+            tmp_path.string(), total, strerror(errno)));
+    }
+    void* ptr = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        throw std::runtime_error(fmt::format(
+            "{}: cannot map: {}", tmp_path.string(), strerror(errno)));
+    uint8_t* data = (uint8_t*)ptr;
+    std::memcpy(data, &header, sizeof(header));
+    Arrays arrays = {
+        (float*)(data + header.states),
+        (float*)(data + header.policies),
+        (float*)(data + header.values),
+        (float*)(data + header.weights)
+    };
+
+    size_t n_threads = config.n_threads;
+    if (n_threads == 0)
+        n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::atomic<size_t> next_game = 0;
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(n_threads);
+    for (size_t t = 0; t < n_threads; t++) {
+        threads.emplace_back([&, t] {
+            Batch batch;
+            size_t g;
+            try {
+                while ((g = next_game.fetch_add(1)) < reader.NumGames()) {
+                    ExportGame(reader, g, first[g], arrays, batch);
+                }
+            }
+            catch (const std::exception& e) {
+                errors[t] = e.what();
+                next_game.store(reader.NumGames());
+            }
+        });
+    }
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    ::msync(data, total, MS_SYNC);
+    ::munmap(data, total);
+    for (const std::string& error: errors) {
+        if (!error.empty()) {
+            std::filesystem::remove(tmp_path);
+            throw std::runtime_error(error);
+        }
+    }
+    std::filesystem::rename(tmp_path, path);
+    return header.n;
+}
+
+
+void DatasetExporter::ExportGame(const LogReader& reader, size_t game,
+    size_t first, const DatasetExporter::Arrays& arrays, Batch& batch) const {
+    const int flat = SIZE * SIZE;
+    const int n_syms = config.augment ? N_SYMMETRIES : 1;
+    LogReader::Game info = reader.GetGame(game);
+    float* policies = arrays.policies + first * flat;
+    float* values = arrays.values + first;
+    float* weights = arrays.weights + first;
+
+    Board board;
+    batch.Clear();
+    for (int move = 0; move < info.length; move++) {
+        for (int sym = 0; sym < n_syms; sym++, policies += flat) {
+            batch.Push(MakeSample(reader, game, move, board, sym, policies,
+                *values++, *weights++));
+        }
+        board.Play(reader.GetAction(game, move));
+    }
+
+    batch.Expand();
+    std::memcpy(arrays.states + first * Input::PLANES * flat,
+        batch.states.data(), batch.states.size() * sizeof(float));
+}
+
+
+std::ostream& operator<<(std::ostream& out, const DatasetExporter::Config& cfg) {
+    out << "DatasetExporter::Config(" << "\n    ";
+    out << "n_threads: " << cfg.n_threads << "\n    ";
+    out << "augment: " << cfg.augment;
+    out << ")";
+    return out;
+}
+
+
+}
+}
@@ -0,0 +1,334 @@
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/format.h>
+#include "gomoku/inference_server.h"
+
+
+
+namespace gomoku {
+
+
+// set from signal handlers, so they have to be lock-free
+std::atomic<bool> stop_requested = false;
+std::atomic<bool> server_reload_requested = false;
+
+
+InferenceServer::InferenceServer(const InferenceServer::Config& cfg)
+: config(cfg), loader(cfg.ld_cfg) {
+    if (config.ld_cfg.max_batch == 0)
+        throw std::runtime_error("InferenceServer max_batch must be positive");
+}
+
+
+void InferenceServer::RequestStop() {
+    stop_requested.store(true);
+}
+
+
+void InferenceServer::RequestReload() {
+    server_reload_requested.store(true);
+}
+
+
+void InferenceServer::Run() {
+    std::cout << "===== Load Evaluator =====" << std::endl;
+    std::filesystem::path model = std::filesystem::canonical(config.model_path);
+    generation = std::max(ReplicaLoader::ModelGeneration(model), 0);
+    std::cout << fmt::format("{}, generation {}", 
+        model.string(), generation) << std::endl;
+    std::vector<Evaluator> evs = loader.Load(model, std::cout);
+    loader.Report(*evs.front(), std::cout);
+    for (Evaluator& ev: evs) {
+        replicas.push_back(std::make_unique<Replica>());
+        replicas.back()->evaluator = std::move(ev);
+    }
+    std::cout << "===== Evaluator Loaded =====" << std::endl;
+
+    channel = std::make_unique<ShmChannel>(config.shm_name, config.n_slots);
+    channel->GetHeader().generation.store(generation);
+    std::cout << fmt::format("serving {} with {} slots", 
+        channel->name, config.n_slots) << std::endl;
+
+    running = true;
+    std::vector<std::thread> threads;
+    for (auto& replica: replicas) {
+        threads.emplace_back(
+            &InferenceServer::ServeThread, this, std::ref(*replica));
+    }
+    while (!stop_requested.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (server_reload_requested.exchange(false))
+            Reload();
+        int n_reclaimed = channel->Reclaim();
+        if (n_reclaimed > 0) {
+            std::cout << fmt::format(
+                "reclaimed {} slots of stopped clients", n_reclaimed) 
+                << std::endl;
+        }
+    }
+
+    running = false;
+    ShmChannel::Wake(channel->GetHeader().pending, INT32_MAX);
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+    // marks the channel stopped, waiting clients give up on it
+    channel.reset();
+    std::cout << "===== Inference Server Stopped =====" << std::endl;
+}
+
+
+void InferenceServer::Reload() {
+    std::error_code ec;
+    std::filesystem::path model
+        = std::filesystem::canonical(config.model_path, ec);
+    if (ec) {
+        std::cerr << fmt::format("reload: cannot resolve {}: {}", 
+            config.model_path.string(), ec.message()) << std::endl;
+        return;
+    }
+    int next_generation = ReplicaLoader::ModelGeneration(model);
+    if (next_generation < 0)
+        next_generation = generation + 1;
+    try {
+        // loaded while the current replicas keep serving
+        std::vector<Evaluator> evs = loader.Load(model, std::cout);
+        for (size_t i = 0; i < replicas.size(); i++) {
+            std::unique_lock<std::mutex> lock(replicas[i]->m_staged);
+            replicas[i]->staged = std::move(evs[i]);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << fmt::format("reload: cannot load {}: {}", 
+            model.string(), e.what()) << std::endl;
+        return;
+    }
+    generation = next_generation;
+    channel->GetHeader().generation.store(generation);
+    std::cout << fmt::format("{}, generation {}", 
+        model.string(), generation) << std::endl;
+}
+
+
+void InferenceServer::ServeThread(InferenceServer::Replica& replica) {
+    replica.evaluator->BindThread();
+    std::vector<uint32_t> idxs;
+    idxs.reserve(config.ld_cfg.max_batch);
+    Batch batch;
+    while (CollectBatch(idxs)) {
+        {
+            std::unique_lock<std::mutex> lock(replica.m_staged);
+            if (replica.staged) {
+                replica.evaluator = std::move(replica.staged);
+                replica.evaluator->BindThread();
+            }
+        }
+
+        batch.Clear();
+        for (uint32_t idx: idxs) {
+            batch.Push(channel->GetSlot(idx).input);
+        }
+        batch.Expand();
+        replica.evaluator->Forward(batch);
+
+        for (int i = 0; i < idxs.size(); i++) {
+            Output output = replica.evaluator->Unpack(batch, i);
+            ShmChannel::Slot& slot = channel->GetSlot(idxs[i]);
+            slot.value = output.first;
+            slot.n_policy = output.second.size();
+            for (int j = 0; j < slot.n_policy; j++) {
+                slot.actions[j] = output.second[j].first;
+                slot.probs[j] = output.second[j].second;
+            }
+            channel->Complete(idxs[i]);
+        }
+        idxs.clear();
+    }
+}
+
+
+bool InferenceServer::CollectBatch(std::vector<uint32_t>& idxs) {
+    // as in EvaluationQueue, replicas take turns forming batches
+    std::unique_lock<std::mutex> collect_lock(m_collect);
+    ShmChannel::Header& header = channel->GetHeader();
+    while (true) {
+        if (!running.load())
+            return false;
+        if (header.pending.load(std::memory_order_acquire) > 0)
+            break;
+        ShmChannel::Wait(header.pending, 0, 100000);
+    }
+
+    std::chrono::steady_clock::time_point deadline
+        = std::chrono::steady_clock::now()
+        + std::chrono::microseconds(config.max_wait_us);
+    uint32_t idx;
+    while (true) {
+        int n_taken = 0;
+        while (channel->TryTake(idx)) {
+            backlog.push_back(idx);
+            n_taken++;
+        }
+        header.pending.fetch_sub(n_taken, std::memory_order_relaxed);
+        if (!running.load())
+            return false;
+        if (backlog.size() >= config.ld_cfg.max_batch)
+            break;
+        std::chrono::steady_clock::time_point now 
+            = std::chrono::steady_clock::now();
+        if (!backlog.empty() && (backlog.size() >= config.min_batch 
+                || now >= deadline))
+            break;
+        // sleeps until a client submits or the deadline passes, as in
+        // ShmChannel::Submit a submit only wakes the server from 0 pending
+        int64_t wait_us = std::max<int64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - now).count(), 1);
+        ShmChannel::Wait(header.pending, 0, std::min<int64_t>(wait_us, 100000));
+    }
+    SelectBatch(idxs);
+    return true;
+}
+
+
+void InferenceServer::SelectBatch(std::vector<uint32_t>& idxs) {
+    size_t batch_size = std::min(backlog.size(), config.ld_cfg.max_batch);
+    if (!config.priority || batch_size == backlog.size()) {
+        idxs.insert(idxs.end(), backlog.begin(), backlog.begin() + batch_size);
+        backlog.erase(backlog.begin(), backlog.begin() + batch_size);
+        return;
+    }
+
+    // requests waiting longer than max_age_us go first, oldest first
+    int64_t old = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count()
+        - config.max_age_us * 1000;
+    auto starving = std::partition(backlog.begin(), backlog.end(), 
+        [&](uint32_t idx) {
+            return channel->GetSlot(idx).enqueued <= old;
+        });
+    std::sort(backlog.begin(), starving, 
+        [&](uint32_t a, uint32_t b) {
+            return channel->GetSlot(a).enqueued < channel->GetSlot(b).enqueued;
+        });
+    if (starving - backlog.begin() < (ptrdiff_t)batch_size) {
+        std::partial_sort(starving, backlog.begin() + batch_size, backlog.end(), 
+            [&](uint32_t a, uint32_t b) {
+                return channel->GetSlot(a).priority 
+                    < channel->GetSlot(b).priority;
+            });
+    }
+    idxs.insert(idxs.end(), backlog.begin(), backlog.begin() + batch_size);
+    backlog.erase(backlog.begin(), backlog.begin() + batch_size);
+}
+
+
+std::ostream& operator<<(std::ostream& out, const InferenceServer::Config& cfg) {
+    out << "InferenceServer::Config(" << "\n    ";
+    out << "model_path: " << cfg.model_path << "\n    ";
+    out << "shm_name: " << cfg.shm_name << "\n    ";
+    out << "n_slots: " << cfg.n_slots << "\n    ";
+    out << "n_evaluators: " << cfg.ld_cfg.n_evaluators << "\n    ";
+    out << "max_batch: " << cfg.ld_cfg.max_batch << "\n    ";
+    out << "min_batch: " << cfg.min_batch << "\n    ";
+    out << "max_wait_us: " << cfg.max_wait_us << "\n    ";
+    out << "priority: " << cfg.priority << "\n    ";
+    out << "max_age_us: " << cfg.max_age_us << "\n    ";
+    out << "warmup_iters: " << cfg.ld_cfg.warmup_iters << "\n    ";
+    out << "evaluator: " << cfg.ld_cfg.ev_cfg;
+    out << ")";
+    return out;
+}
+
+
+boost::program_options::options_description
+GetInferenceServerConfig(InferenceServer::Config& cfg) {
+    boost::program_options::options_description desc("Inference server config");
+    desc.add_options()
+        (
+            "model_path", 
+            boost::program_options::value<std::filesystem::path>
+                (&cfg.model_path)->required(), 
+            "torch jit module path, or weight file for the native backend"
+        )
+        (
+            "shm_name", 
+            boost::program_options::value<std::string>(&cfg.shm_name)
+                ->default_value("gomoku"), 
+            "name of the shared memory segment clients connect to"
+        )
+        (
+            "n_slots", 
+            boost::program_options::value<uint32_t>(&cfg.n_slots)
+                ->default_value(4096), 
+            "number of request slots shared by all clients"
+        )
+        (
+            "n_evaluators", 
+            boost::program_options::value<size_t>(&cfg.ld_cfg.n_evaluators)
+                ->default_value(1), 
+            "number of evaluator replicas, each with its own model copy"
+        )
+        (
+            "replica_threads", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.ld_cfg.replica_threads)->multitoken(), 
+            "intra-op threads of each evaluator replica, one value for all "
+            "or one per replica"
+        )
+        (
+            "max_batch", 
+            boost::program_options::value<size_t>(&cfg.ld_cfg.max_batch)
+                ->default_value(256), 
+            "maximum number of positions in a single evaluation batch"
+        )
+        (
+            "min_batch", 
+            boost::program_options::value<size_t>(&cfg.min_batch)
+                ->default_value(1), 
+            "number of positions a batch waits for before being evaluated"
+        )
+        (
+            "max_wait_us", 
+            boost::program_options::value<int64_t>(&cfg.max_wait_us)
+                ->default_value(0), 
+            "maximum microseconds to wait for min_batch positions"
+        )
+        (
+            "priority", 
+            boost::program_options::bool_switch(&cfg.priority),
+            "batch requests of searches closest to completion first"
+        )
+        (
+            "max_age_us", 
+            boost::program_options::value<int64_t>(&cfg.max_age_us)
+                ->default_value(5000),
+            "microseconds after which a request is batched regardless of "
+            "priority"
+        )
+        (
+            "warmup_iters", 
+            boost::program_options::value<int>(&cfg.ld_cfg.warmup_iters)
+                ->default_value(5), 
+            "passes over the warmup batch sizes before serving, 0 to skip"
+        )
+        (
+            "warmup_batches", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.ld_cfg.warmup_batches)->multitoken(), 
+            "batch sizes to warm up on, defaults to powers of two up to "
+            "max_batch"
+        )
+        (
+            "report_batches", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.ld_cfg.report_batches)->multitoken(), 
+            "batch sizes to report ready-state evaluation latency for"
+        )
+    ;
+    return desc;
+}
+
+
+}
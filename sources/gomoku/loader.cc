@@ -0,0 +1,202 @@
+#include <chrono>
+#include <thread>
+#include <random>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#ifdef GOMOKU_WITH_TORCH
+#include <torch/torch.h>
+#include "gomoku/torch_evaluator.h"
+#endif
+#include "nn/kernels.h"
+#include "gomoku/loader.h"
+#include "gomoku/board.h"
+#include "gomoku/native_evaluator.h"
+
+
+
+namespace gomoku {
+
+
+ReplicaLoader::ReplicaLoader(ReplicaLoader::Config conf): config(conf) {}
+
+
+std::vector<ReplicaLoader::Evaluator> ReplicaLoader::Load(
+    const std::filesystem::path& model, std::ostream& out) const {
+    std::vector<int> threads = ReplicaThreads();
+    std::vector<Evaluator> evs;
+    for (size_t i = 0; i < config.n_evaluators; i++) {
+        evs.push_back(LoadReplica(model, i, threads[i], out));
+    }
+    if (config.warmup_iters <= 0)
+        return evs;
+
+    // graph specialization of a fresh module makes the first batches slow,
+    // they are run here so that no search waits on them
+    out << fmt::format("warming up on batch sizes {}", 
+        fmt::join(WarmupBatches(), ", ")) << std::endl;
+    std::chrono::steady_clock::time_point st = std::chrono::steady_clock::now();
+    std::vector<std::thread> warmers;
+    for (Evaluator& ev: evs) {
+        warmers.emplace_back(&ReplicaLoader::WarmUp, this, std::ref(*ev));
+    }
+    for (std::thread& warmer: warmers) {
+        warmer.join();
+    }
+    out << fmt::format("warmup done in {:.1f} sec", 
+        std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - st).count()) << std::endl;
+    return evs;
+}
+
+
+void ReplicaLoader::Report(GomokuEvaluator& ev, std::ostream& out) const {
+    if (config.warmup_iters <= 0 && config.report_batches.empty())
+        return;
+    out << "ready-state evaluation latency:" << std::endl;
+    ev.Benchmark(config.report_batches.empty()
+        ? WarmupBatches() : config.report_batches, 10, out);
+}
+
+
+int ReplicaLoader::ModelGeneration(const std::filesystem::path& model) {
+    // the last number in the stem
+    std::string stem = model.stem().string();
+    size_t ed = stem.size();
+    while (ed > 0 && !std::isdigit((unsigned char)stem[ed - 1]))
+        ed--;
+    size_t st = ed;
+    while (st > 0 && std::isdigit((unsigned char)stem[st - 1]))
+        st--;
+    if (st == ed || ed - st > 9)
+        return -1;
+    return std::stoi(stem.substr(st, ed - st));
+}
+
+
+std::vector<int> ReplicaLoader::WarmupBatches() const {
+    if (!config.warmup_batches.empty())
+        return config.warmup_batches;
+    // powers of two up to max_batch, batch sizes seen in selfplay vary
+    std::vector<int> sizes;
+    int max_batch = config.max_batch;
+    for (int size = 1; size < max_batch; size *= 2) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(max_batch);
+    return sizes;
+}
+
+
+void ReplicaLoader::WarmUp(GomokuEvaluator& ev) const {
+    ev.BindThread();
+    Board board;
+    board.Play(SIZE / 2, SIZE / 2);
+    for (int it = 0; it < config.warmup_iters; it++) {
+        for (int size: WarmupBatches()) {
+            std::vector<Input> inputs;
+            for (int i = 0; i < size; i++) {
+                inputs.push_back(GomokuEvaluator::Preprocess(board));
+            }
+            ev.EvaluateBatch(inputs);
+        }
+    }
+}
+
+
+std::filesystem::path ReplicaLoader::OptimizedPath(
+    const std::filesystem::path& model, const std::string& device) const {
+    // a frozen module is specific to the device type and precision
+    std::ostringstream precision;
+    precision << config.ev_cfg.precision;
+    return model.parent_path() / fmt::format("{}.{}-{}.opt.pt", 
+        model.stem().string(), device, precision.str());
+}
+
+
+ReplicaLoader::Evaluator ReplicaLoader::LoadReplica(
+    const std::filesystem::path& model, size_t idx, int threads, 
+    std::ostream& out) const {
+    GomokuEvaluator::Config ev_cfg = config.ev_cfg;
+    ev_cfg.intra_threads = threads;
+
+    if (ev_cfg.backend == GomokuEvaluator::Backend::NATIVE) {
+        out << fmt::format("replica {}: native {}", 
+            idx, nn::KernelIsa()) << std::endl;
+        return std::make_unique<NativeEvaluator>(model, ev_cfg);
+    }
+#ifdef GOMOKU_WITH_TORCH
+    // every replica owns its module, so forward passes run concurrently
+    int n_devices = torch::cuda::is_available() ? torch::cuda::device_count() : 0;
+    torch::Device device = (n_devices > 0)
+        ? torch::Device(torch::kCUDA, idx % n_devices)
+        : torch::Device(torch::kCPU);
+    bool save_optimized = ev_cfg.optimize && ev_cfg.save_optimized;
+    std::filesystem::path optimized
+        = OptimizedPath(model, device.is_cuda() ? "cuda" : "cpu");
+    std::error_code ec;
+    std::filesystem::file_time_type optimized_time
+        = std::filesystem::last_write_time(optimized, ec);
+    bool cached = save_optimized && !ec
+        && optimized_time >= std::filesystem::last_write_time(model);
+    out << fmt::format("replica {}: {}, {} intra-op threads{}", 
+        idx, device.str(), threads, 
+        cached ? ", " + optimized.filename().string() : "") << std::endl;
+
+    if (cached) {
+        // already frozen, only needs to be mapped onto this device
+        ev_cfg.optimize = false;
+        torch::jit::script::Module module(torch::jit::load(optimized, device));
+        return std::make_unique<TorchEvaluator>(
+            std::move(module), device, ev_cfg);
+    }
+    torch::jit::script::Module module(torch::jit::load(model));
+    std::unique_ptr<TorchEvaluator> ev = std::make_unique<TorchEvaluator>(
+        std::move(module), device, ev_cfg);
+    if (save_optimized) {
+        // renamed into place, so other launches never load a partial file
+        std::filesystem::path tmp = optimized;
+        tmp += fmt::format(".{}.tmp", std::random_device{}());
+        try {
+            ev->Save(tmp);
+            std::filesystem::rename(tmp, optimized);
+        }
+        catch (const std::exception& e) {
+            std::filesystem::remove(tmp, ec);
+            std::cerr << fmt::format("cannot save {}: {}", 
+                optimized.string(), e.what()) << std::endl;
+        }
+    }
+    return ev;
+#else
+    throw std::runtime_error("built without libtorch, use the native backend");
+#endif
+}
+
+
+std::vector<int> ReplicaLoader::ReplicaThreads() const {
+    if (config.n_evaluators == 0)
+        throw std::runtime_error("n_evaluators must be positive");
+    if (!config.replica_threads.empty()) {
+        if (config.replica_threads.size() == config.n_evaluators)
+            return config.replica_threads;
+        if (config.replica_threads.size() == 1)
+            return std::vector<int>(
+                config.n_evaluators, config.replica_threads.front());
+        throw std::runtime_error(fmt::format(
+            "replica_threads has {} entries for {} evaluators", 
+            config.replica_threads.size(), config.n_evaluators));
+    }
+    if (config.ev_cfg.intra_threads > 0 || config.n_evaluators == 1)
+        return std::vector<int>(config.n_evaluators, config.ev_cfg.intra_threads);
+    // split the cores evenly between the replicas
+    int cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+    return std::vector<int>(
+        config.n_evaluators, std::max<int>(cores / config.n_evaluators, 1));
+}
+
+
+}
@@ -10,45 +10,63 @@ namespace gomoku {
 namespace logger {
 
 
-Log::Log(const Log& log): header(log.header) {
+Log::Log(const Log& log): header(log.header), extension(log.extension) {
     flat = header.size * header.size;
     actions_ptr = new int32_t[header.len];
     counts_ptr = new int32_t[header.len * flat];
+    full_ptr = new uint8_t[header.len];
+    searches_ptr = new int32_t[header.len];
     std::memcpy(actions_ptr, log.actions_ptr, sizeof(int32_t) * header.len);
     std::memcpy(counts_ptr, log.counts_ptr, sizeof(int32_t) * header.len * flat);
+    std::memcpy(full_ptr, log.full_ptr, header.len);
+    std::memcpy(searches_ptr, log.searches_ptr, sizeof(int32_t) * header.len);
 }
 
 
-Log::Log(Log&& log): header(log.header) {
+Log::Log(Log&& log): header(log.header), extension(log.extension) {
     flat = header.size * header.size;
     actions_ptr = log.actions_ptr;
     counts_ptr = log.counts_ptr;
+    full_ptr = log.full_ptr;
+    searches_ptr = log.searches_ptr;
     log.header = Log::Header();
     log.actions_ptr = nullptr;
     log.counts_ptr = nullptr;
+    log.full_ptr = nullptr;
+    log.searches_ptr = nullptr;
 }
 
 
 Log& Log::operator=(const Log& log) {
     header = log.header;
+    extension = log.extension;
     flat = header.size * header.size;
     actions_ptr = new int32_t[header.len];
     counts_ptr = new int32_t[header.len * flat];
+    full_ptr = new uint8_t[header.len];
+    searches_ptr = new int32_t[header.len];
     std::memcpy(actions_ptr, log.actions_ptr, sizeof(int32_t) * header.len);
     std::memcpy(counts_ptr, log.counts_ptr, sizeof(int32_t) * header.len * flat);
+    std::memcpy(full_ptr, log.full_ptr, header.len);
+    std::memcpy(searches_ptr, log.searches_ptr, sizeof(int32_t) * header.len);
     return *this;
 }
 
 
 Log& Log::operator=(Log&& log) {
     header = log.header;
+    extension = log.extension;
     flat = header.size * header.size;
     actions_ptr = log.actions_ptr;
     counts_ptr = log.counts_ptr;
+    full_ptr = log.full_ptr;
+    searches_ptr = log.searches_ptr;
     log.header = Log::Header();
     log.flat = log.header.size * log.header.size;
     log.actions_ptr = nullptr;
     log.counts_ptr = nullptr;
+    log.full_ptr = nullptr;
+    log.searches_ptr = nullptr;
     return *this;
 }
 
@@ -56,6 +74,8 @@ Log& Log::operator=(Log&& log) {
 Log::~Log() {
     delete[] actions_ptr;
     delete[] counts_ptr;
+    delete[] full_ptr;
+    delete[] searches_ptr;
 }
 
 
@@ -63,9 +83,13 @@ Log::Log(
     int game_len, 
     Board::State result,
     const std::vector<mcts::Action>& actions, 
-    const std::vector<std::vector<int>>& counts
+    const std::vector<std::vector<int>>& counts,
+    int generation,
+    const std::vector<bool>& full_search,
+    const std::vector<int>& searches
 ) {
     header.len = game_len;
+    extension.generation = generation;
     if (result == Board::State::BLACK_WIN)
         header.result = 1;
     else if (result == Board::State::WHITE_WIN)
@@ -78,12 +102,20 @@ Log::Log(
     flat = header.size * header.size;
     actions_ptr = new int32_t[header.len];
     counts_ptr = new int32_t[header.len * flat];
+    full_ptr = new uint8_t[header.len];
+    searches_ptr = new int32_t[header.len];
     int offset = 0;
     for (int i = 0; i < game_len; i++, offset += flat) {
         actions_ptr[i] = actions[i];
+        full_ptr[i] = full_search.empty() || full_search[i];
+        // without them, the searches are what the counts sum to
+        searches_ptr[i] = 0;
         for (int action = 0; action < flat; action++) {
             counts_ptr[action + offset] = counts[i][action];
+            searches_ptr[i] += counts[i][action];
         }
+        if (!searches.empty())
+            searches_ptr[i] = searches[i];
     }
 }
 
@@ -96,6 +128,9 @@ void Log::Save(const std::string& path) const {
     out.write((char*)(&header), sizeof(header));
     out.write((char*)actions_ptr, sizeof(int32_t) * header.len);
     out.write((char*)counts_ptr, sizeof(int32_t) * header.len * flat);
+    out.write((char*)(&extension), sizeof(extension));
+    out.write((char*)full_ptr, header.len);
+    out.write((char*)searches_ptr, sizeof(int32_t) * header.len);
 
     out.close();
 }
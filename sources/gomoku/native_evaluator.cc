@@ -0,0 +1,225 @@
+
+#include <cmath>
+#include <algorithm>
+#include <fmt/format.h>
+#include "nn/kernels.h"
+#include "gomoku/native_evaluator.h"
+
+
+namespace gomoku {
+
+
+namespace {
+
+// torch.nn.BatchNorm2d default
+constexpr float BN_EPS = 1e-5;
+
+}
+
+
+NativeEvaluator::NativeEvaluator(const std::string& weights_path)
+: NativeEvaluator::NativeEvaluator(weights_path, Config()) {}
+
+
+NativeEvaluator::NativeEvaluator
+(const std::string& weights_path, GomokuEvaluator::Config conf)
+: NativeEvaluator::NativeEvaluator(nn::WeightFile(weights_path), conf) {}
+
+
+NativeEvaluator::NativeEvaluator
+(const nn::WeightFile& weights, GomokuEvaluator::Config conf)
+: GomokuEvaluator(conf) {
+    Load(weights);
+}
+
+
+NativeEvaluator::Conv NativeEvaluator::LoadConv(
+    const nn::WeightFile& weights, const std::string& prefix, 
+    const std::string& conv, const std::string& bn, int c_in, int kernel) {
+    const nn::Tensor& w = weights.Get(prefix + conv + ".weight");
+    if (w.shape.size() != 4 || w.shape[1] != c_in 
+            || w.shape[2] != kernel || w.shape[3] != kernel)
+        throw std::runtime_error(fmt::format(
+            "weights: {}{}.weight is not a {}x{} conv over {} channels", 
+            prefix, conv, kernel, kernel, c_in));
+
+    Conv ret;
+    ret.c_out = w.shape[0];
+    ret.c_in = c_in;
+    ret.kernel = kernel;
+    ret.w = w.data;
+    ret.b.assign(ret.c_out, 0.f);
+    if (weights.Has(prefix + conv + ".bias"))
+        ret.b = weights.Get(prefix + conv + ".bias", {ret.c_out}).data;
+
+    const std::vector<int> channels = {ret.c_out};
+    const nn::Tensor& gamma = weights.Get(prefix + bn + ".weight", channels);
+    const nn::Tensor& beta = weights.Get(prefix + bn + ".bias", channels);
+    const nn::Tensor& mean = weights.Get(prefix + bn + ".running_mean", channels);
+    const nn::Tensor& var = weights.Get(prefix + bn + ".running_var", channels);
+
+    const size_t per_out = ret.w.size() / ret.c_out;
+    for (int o = 0; o < ret.c_out; o++) {
+        float scale = gamma.data[o] / std::sqrt(var.data[o] + BN_EPS);
+        for (size_t i = 0; i < per_out; i++)
+            ret.w[o * per_out + i] *= scale;
+        ret.b[o] = beta.data[o] + (ret.b[o] - mean.data[o]) * scale;
+    }
+    return ret;
+}
+
+
+NativeEvaluator::Dense NativeEvaluator::LoadDense(
+    const nn::WeightFile& weights, const std::string& name, int n_in) {
+    const nn::Tensor& w = weights.Get(name + ".weight");
+    if (w.shape.size() != 2 || w.shape[1] != n_in)
+        throw std::runtime_error(fmt::format(
+            "weights: {}.weight is not a linear layer over {} features", 
+            name, n_in));
+    Dense ret;
+    ret.n_out = w.shape[0];
+    ret.n_in = n_in;
+    ret.w = w.data;
+    ret.b = weights.Get(name + ".bias", {ret.n_out}).data;
+    return ret;
+}
+
+
+void NativeEvaluator::Load(const nn::WeightFile& weights) {
+    const int flat_size = SIZE * SIZE;
+    stem = LoadConv(weights, "stem.", "conv", "bn", Input::PLANES, 3);
+    const int channels = stem.c_out;
+    for (int i = 0; ; i++) {
+        std::string prefix = fmt::format("blocks.{}.", i);
+        if (!weights.Has(prefix + "conv1.weight"))
+            break;
+        Conv conv1 = LoadConv(weights, prefix, "conv1", "bn1", channels, 3);
+        Conv conv2 = LoadConv(weights, prefix, "conv2", "bn2", conv1.c_out, 3);
+        if (conv2.c_out != channels)
+            throw std::runtime_error(prefix + "conv2 changes the channel count");
+        blocks.emplace_back(std::move(conv1), std::move(conv2));
+    }
+
+    policy_conv = LoadConv(weights, "policy.", "conv", "bn", channels, 1);
+    policy_fc = LoadDense(weights, "policy.fc", policy_conv.c_out * flat_size);
+    if (policy_fc.n_out != flat_size)
+        throw std::runtime_error("weights: policy.fc does not output the board");
+
+    value_conv = LoadConv(weights, "value.", "conv", "bn", channels, 1);
+    value_fc1 = LoadDense(weights, "value.fc1", value_conv.c_out * flat_size);
+    value_fc2 = LoadDense(weights, "value.fc2", value_fc1.n_out);
+    if (value_fc2.n_out != 1)
+        throw std::runtime_error("weights: value.fc2 does not output a scalar");
+
+    if (weights.Has("turn_embed.weight"))
+        turn_embed = weights.Get("turn_embed.weight", {2, channels}).data;
+}
+
+
+void NativeEvaluator::ConvForward(
+    const Conv& conv, int batch, const float* in, const float* residual, 
+    bool relu, float* out) {
+    const int n = batch * SIZE * SIZE;
+    const float* cols = in;
+    if (conv.kernel == 3) {
+        col.resize((size_t)conv.c_in * 9 * n);
+        nn::Im2Col3x3(conv.c_in, batch, SIZE, SIZE, in, col.data());
+        cols = col.data();
+    }
+    nn::Gemm(conv.c_out, n, conv.c_in * conv.kernel * conv.kernel, 
+        conv.w.data(), cols, conv.b.data(), residual, relu, out);
+}
+
+
+void NativeEvaluator::Flatten
+(int channels, int batch, const float* in, float* out) const {
+    // [channels, batch * plane] into [channels * plane, batch], the
+    // row order matches flattening a [batch, channels, h, w] tensor
+    const int plane = SIZE * SIZE;
+    for (int c = 0; c < channels; c++) {
+        for (int b = 0; b < batch; b++) {
+            const float* src = in + ((size_t)c * batch + b) * plane;
+            for (int s = 0; s < plane; s++)
+                out[((size_t)c * plane + s) * batch + b] = src[s];
+        }
+    }
+}
+
+
+void NativeEvaluator::Forward(Batch& batch) {
+    const int size = batch.size;
+    const int plane = SIZE * SIZE;
+    const size_t n = (size_t)size * plane;
+    const int channels = stem.c_out;
+
+    // activations are kept as [channels, batch * plane]
+    tmp.resize(Input::PLANES * n);
+    for (int c = 0; c < Input::PLANES; c++) {
+        for (int b = 0; b < size; b++) {
+            std::copy_n(
+                batch.states.data() + (b * Input::PLANES + c) * plane, plane, 
+                tmp.data() + c * n + b * plane);
+        }
+    }
+
+    act.resize(channels * n);
+    if (turn_embed.empty()) {
+        ConvForward(stem, size, tmp.data(), nullptr, true, act.data());
+    }
+    else {
+        ConvForward(stem, size, tmp.data(), nullptr, false, act.data());
+        for (int c = 0; c < channels; c++) {
+            for (int b = 0; b < size; b++) {
+                float bias = turn_embed[batch.turns[b] * channels + c];
+                float* ptr = act.data() + c * n + b * plane;
+                for (int s = 0; s < plane; s++)
+                    ptr[s] = std::max(ptr[s] + bias, 0.f);
+            }
+        }
+    }
+
+    for (const auto& [conv1, conv2]: blocks) {
+        tmp.resize(conv1.c_out * n);
+        next.resize(channels * n);
+        ConvForward(conv1, size, act.data(), nullptr, true, tmp.data());
+        ConvForward(conv2, size, tmp.data(), act.data(), true, next.data());
+        std::swap(act, next);
+    }
+
+    // policy head
+    tmp.resize(policy_conv.c_out * n);
+    ConvForward(policy_conv, size, act.data(), nullptr, true, tmp.data());
+    flat.resize(policy_conv.c_out * n);
+    Flatten(policy_conv.c_out, size, tmp.data(), flat.data());
+    logits.resize(n);
+    nn::Gemm(plane, size, policy_fc.n_in, policy_fc.w.data(), flat.data(), 
+        policy_fc.b.data(), nullptr, false, logits.data());
+
+    // value head
+    tmp.resize(value_conv.c_out * n);
+    ConvForward(value_conv, size, act.data(), nullptr, true, tmp.data());
+    flat.resize(value_conv.c_out * n);
+    Flatten(value_conv.c_out, size, tmp.data(), flat.data());
+    hidden.resize((size_t)value_fc1.n_out * size);
+    nn::Gemm(value_fc1.n_out, size, value_fc1.n_in, value_fc1.w.data(), 
+        flat.data(), value_fc1.b.data(), nullptr, true, hidden.data());
+    values.resize(size);
+    nn::Gemm(1, size, value_fc2.n_in, value_fc2.w.data(), hidden.data(), 
+        value_fc2.b.data(), nullptr, false, values.data());
+
+    batch.k = plane;
+    batch.values.resize(size);
+    batch.probs.resize(n);
+    std::vector<float> sample_logits(plane);
+    for (int b = 0; b < size; b++) {
+        for (int s = 0; s < plane; s++)
+            sample_logits[s] = logits[(size_t)s * size + b];
+        nn::MaskedSoftmax(plane, sample_logits.data(), 
+            batch.masks.data() + b * plane, batch.probs.data() + b * plane);
+        batch.values[b] = std::tanh(values[b]);
+    }
+}
+
+
+}
+
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include "gomoku/opening_book.h"
+#include "gomoku/board.h"
+
+
+namespace gomoku {
+namespace selfplay {
+
+
+OpeningBook::OpeningBook(const OpeningBook::Config& conf): config(conf) {}
+
+
+bool OpeningBook::Covers(int n_stones) const {
+    return n_stones < config.max_stones;
+}
+
+
+std::string OpeningBook::Key(
+    const std::vector<mcts::Action>& actions, int& sym) {
+    std::string best;
+    for (int s = 0; s < N_SYMMETRIES; s++) {
+        // black's stones then white's, each sorted, as 2 bytes an action
+        std::vector<mcts::Action> stones[2];
+        for (int i = 0; i < actions.size(); i++) {
+            stones[i % 2].push_back(
+                Coord2Action(Transform(Action2Coord(actions[i]), s)));
+        }
+        std::string key;
+        for (int color = 0; color < 2; color++) {
+            std::sort(stones[color].begin(), stones[color].end());
+            for (mcts::Action action: stones[color]) {
+                key.push_back((char)(action >> 8));
+                key.push_back((char)(action & 0xff));
+            }
+            key.push_back('|');
+        }
+        if (s == 0 || key < best) {
+            best = std::move(key);
+            sym = s;
+        }
+    }
+    return best;
+}
+
+
+void OpeningBook::Renew(int generation_) {
+    if (generation_ == generation)
+        return;
+    entries.clear();
+    generation = generation_;
+}
+
+
+std::vector<MCTS::ChildStats> OpeningBook::Lookup(
+    const std::vector<mcts::Action>& actions, int generation_) {
+    int sym;
+    std::string key = Key(actions, sym);
+    std::vector<MCTS::ChildStats> stats;
+    std::unique_lock<std::mutex> lock(m);
+    Renew(generation_);
+    n_lookups++;
+    auto iter = entries.find(key);
+    if (iter == entries.end())
+        return stats;
+    n_hits++;
+    stats = iter->second;
+    lock.unlock();
+
+    for (MCTS::ChildStats& child: stats) {
+        child.action = Coord2Action(
+            InverseTransform(Action2Coord(child.action), sym));
+    }
+    return stats;
+}
+
+
+void OpeningBook::Add(const std::vector<mcts::Action>& actions,
+    int generation_, const std::vector<MCTS::ChildStats>& stats) {
+    int sym;
+    std::string key = Key(actions, sym);
+    std::unique_lock<std::mutex> lock(m);
+    // searched with an older model
+    if (generation_ != generation)
+        return;
+    std::vector<MCTS::ChildStats>& entry = entries[key];
+    int total = 0;
+    for (const MCTS::ChildStats& child: stats) {
+        if (child.n <= 0)
+            continue;
+        mcts::Action action = Coord2Action(
+            Transform(Action2Coord(child.action), sym));
+        auto iter = std::find_if(entry.begin(), entry.end(),
+            [action](const MCTS::ChildStats& other) {
+                return other.action == action;
+            });
+        if (iter == entry.end()) {
+            entry.push_back({action, child.n, child.w});
+        }
+        else {
+            iter->n += child.n;
+            iter->w += child.w;
+        }
+    }
+    for (const MCTS::ChildStats& child: entry) {
+        total += child.n;
+    }
+    if (total <= config.max_visits)
+        return;
+
+    for (MCTS::ChildStats& child: entry) {
+        int n = child.n / 2;
+        child.w = child.w * n / child.n;
+        child.n = n;
+    }
+    entry.erase(std::remove_if(entry.begin(), entry.end(),
+        [](const MCTS::ChildStats& child) {
+            return child.n == 0;
+        }), entry.end());
+}
+
+
+size_t OpeningBook::NumPositions() const {
+    std::unique_lock<std::mutex> lock(m);
+    return entries.size();
+}
+
+
+size_t OpeningBook::NumLookups() const {
+    std::unique_lock<std::mutex> lock(m);
+    return n_lookups;
+}
+
+
+size_t OpeningBook::NumHits() const {
+    std::unique_lock<std::mutex> lock(m);
+    return n_hits;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const OpeningBook::Config& cfg) {
+    out << "OpeningBook::Config(" << "\n    ";
+    out << "max_stones: " << cfg.max_stones << "\n    ";
+    out << "max_visits: " << cfg.max_visits;
+    out << ")";
+    return out;
+}
+
+
+}
+}
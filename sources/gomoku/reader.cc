@@ -0,0 +1,502 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fmt/format.h>
+#include "gomoku/reader.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+MappedFile::MappedFile(const std::filesystem::path& path_): path(path_) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(fmt::format(
+            "{}: cannot open: {}", path.string(), strerror(errno)));
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format(
+            "{}: cannot stat: {}", path.string(), strerror(errno)));
+    }
+    size = st.st_size;
+    if (size > 0) {
+        void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error(fmt::format(
+                "{}: cannot map: {}", path.string(), strerror(errno)));
+        }
+        data = (const uint8_t*)ptr;
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+}
+
+
+MappedFile::~MappedFile() {
+    if (data)
+        ::munmap((void*)data, size);
+}
+
+
+Visits::Visits(const int32_t* dense_): dense(dense_), n_visited(-1) {}
+
+
+Visits::Visits(const uint8_t* ptr_, const uint8_t* end_, int n_visited_)
+: ptr(ptr_), end_ptr(end_), n_visited(n_visited_) {}
+
+
+Visits::Iterator Visits::begin() const {
+    Iterator it;
+    it.dense = dense;
+    it.ptr = ptr;
+    it.end = end_ptr;
+    it.left = dense ? 1 : n_visited;
+    if (it.left > 0)
+        it.Next();
+    return it;
+}
+
+
+int Visits::Size() const {
+    if (!dense)
+        return n_visited;
+    return std::count_if(dense, dense + SIZE * SIZE,
+        [](int32_t n) { return n > 0; });
+}
+
+
+Visits::Iterator& Visits::Iterator::operator++() {
+    if (dense || --left > 0)
+        Next();
+    return *this;
+}
+
+
+void Visits::Iterator::Next() {
+    if (dense) {
+        for (mcts::Action action = prev + 1; action < SIZE * SIZE; action++) {
+            if (dense[action] > 0) {
+                current = {action, dense[action]};
+                prev = action;
+                return;
+            }
+        }
+        left = 0;
+        return;
+    }
+    uint64_t delta, n;
+    if (!GetVarint(ptr, end, delta) || !GetVarint(ptr, end, n)) {
+        left = 0;
+        return;
+    }
+    prev += delta + 1;
+    current = {prev, (int)n};
+}
+
+
+LogReader::LogReader(
+    const std::vector<std::filesystem::path>& paths, bool save_index) {
+    game_base.push_back(0);
+    position_base.push_back(0);
+    for (const std::filesystem::path& path: Collect(paths)) {
+        Source source;
+        source.data = std::make_unique<MappedFile>(path);
+        Open(source, save_index);
+        game_base.push_back(game_base.back() + source.header->n_games);
+        position_base.push_back(
+            position_base.back() + source.header->n_positions);
+        sources.push_back(std::move(source));
+    }
+}
+
+
+LogReader::LogReader(const std::filesystem::path& path,
+    const LogReader& previous, bool save_index) {
+    game_base.push_back(0);
+    position_base.push_back(0);
+    Source source;
+    source.data = std::make_unique<MappedFile>(path);
+    const Source* prev = nullptr;
+    if (previous.sources.size() == 1 && previous.sources[0].data->path == path)
+        prev = &previous.sources[0];
+    Open(source, save_index, prev);
+    game_base.push_back(source.header->n_games);
+    position_base.push_back(source.header->n_positions);
+    sources.push_back(std::move(source));
+}
+
+
+std::vector<std::filesystem::path> LogReader::Collect(
+    const std::vector<std::filesystem::path>& paths) {
+    std::vector<std::filesystem::path> ret;
+    for (const std::filesystem::path& path: paths) {
+        if (!std::filesystem::is_directory(path)) {
+            ret.push_back(path);
+            continue;
+        }
+        std::vector<std::filesystem::path> found;
+        for (const auto& entry:
+            std::filesystem::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".bin")
+                found.push_back(entry.path());
+        }
+        std::sort(found.begin(), found.end());
+        ret.insert(ret.end(), found.begin(), found.end());
+    }
+    return ret;
+}
+
+
+void LogReader::Open(LogReader::Source& source, bool save_index,
+    const LogReader::Source* previous) {
+    const MappedFile& file = *source.data;
+    struct stat st;
+    if (::stat(file.path.c_str(), &st) != 0)
+        throw std::runtime_error(fmt::format(
+            "{}: cannot stat: {}", file.path.string(), strerror(errno)));
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000
+        + st.st_mtim.tv_nsec;
+
+    std::filesystem::path index_path = file.path.string() + ".idx";
+    if (std::filesystem::exists(index_path)) {
+        source.mapped_index = std::make_unique<MappedFile>(index_path);
+        const IndexHeader* header
+            = (const IndexHeader*)source.mapped_index->Data();
+        if (source.mapped_index->Size() >= sizeof(IndexHeader)
+            && header->magic == IndexHeader::MAGIC
+            && header->version == IndexHeader::VERSION
+            && header->source_size == file.Size()
+            && header->source_mtime == mtime
+            && source.mapped_index->Size() == sizeof(IndexHeader)
+                + header->n_games * sizeof(GameEntry)
+                + header->n_positions * sizeof(PositionEntry)) {
+            source.header = header;
+        }
+        else {
+            source.mapped_index.reset();
+        }
+    }
+
+    if (!source.mapped_index) {
+        source.built_index = BuildIndex(file, previous);
+        IndexHeader* header = (IndexHeader*)source.built_index.data();
+        header->source_size = file.Size();
+        header->source_mtime = mtime;
+        source.header = header;
+        if (save_index) {
+            // renamed into place, so readers never see half an index
+            std::filesystem::path tmp_path = index_path.string() + ".tmp";
+            std::ofstream out(tmp_path, std::ios::out | std::ios::binary);
+            out.write(source.built_index.data(), source.built_index.size());
+            out.close();
+            std::error_code ec;
+            if (out)
+                std::filesystem::rename(tmp_path, index_path, ec);
+            if (out && !ec) {
+                source.mapped_index = std::make_unique<MappedFile>(index_path);
+                source.header = (const IndexHeader*)source.mapped_index->Data();
+                source.built_index.clear();
+            }
+            else {
+                std::filesystem::remove(tmp_path, ec);
+            }
+        }
+    }
+    source.games = (const GameEntry*)(source.header + 1);
+    source.positions
+        = (const PositionEntry*)(source.games + source.header->n_games);
+}
+
+
+bool LogReader::ResumeOffset(const MappedFile& file,
+    const LogReader::Source& previous, uint64_t& start) {
+    const MappedFile& old = *previous.data;
+    uint64_t n_games = previous.header->n_games;
+    if (old.Size() < sizeof(ShardHeader) || file.Size() < old.Size()
+        || std::memcmp(old.Data(), file.Data(), sizeof(ShardHeader)) != 0)
+        return false;
+    if (n_games == 0) {
+        start = sizeof(ShardHeader);
+        return true;
+    }
+    // the last record indexed has to be unchanged, the ones before it are
+    // never rewritten
+    const GameEntry& last = previous.games[n_games - 1];
+    if (last.dense || last.offset + RECORD_HEADER > old.Size()
+        || std::memcmp(old.Data() + last.offset, file.Data() + last.offset,
+            RECORD_HEADER) != 0)
+        return false;
+    uint32_t payload_size;
+    std::memcpy(&payload_size, file.Data() + last.offset + sizeof(uint32_t),
+        sizeof(uint32_t));
+    start = last.offset + RECORD_HEADER + payload_size;
+    return start <= file.Size();
+}
+
+
+std::string LogReader::BuildIndex(const MappedFile& file,
+    const LogReader::Source* previous) {
+    std::vector<GameEntry> games;
+    std::vector<PositionEntry> positions;
+    const uint8_t* data = file.Data();
+    const int32_t flat = SIZE * SIZE;
+
+    if (file.Size() < sizeof(ShardHeader)) {
+        // a shard just being created, nothing to read yet
+    }
+    else if (((const ShardHeader*)data)->magic == ShardHeader::MAGIC) {
+        const ShardHeader* shard_header = (const ShardHeader*)data;
+        if (shard_header->version < 1
+            || shard_header->version > ShardHeader::VERSION
+            || shard_header->size != SIZE)
+            throw std::runtime_error(fmt::format(
+                "{}: not a version {} shard of size {}",
+                file.path.string(), ShardHeader::VERSION, SIZE));
+        bool has_full = shard_header->version >= 2;
+        bool has_searches = shard_header->version >= 3;
+        uint64_t start = sizeof(ShardHeader);
+        if (previous && ResumeOffset(file, *previous, start)) {
+            games.assign(previous->games, 
+                previous->games + previous->header->n_games);
+            positions.assign(previous->positions, 
+                previous->positions + previous->header->n_positions);
+        }
+        else {
+            start = sizeof(ShardHeader);
+        }
+        std::vector<std::pair<int64_t, uint64_t>> records;
+        ScanRecords(data, file.Size(), records, start);
+        for (auto [game_idx, offset]: records) {
+            const uint8_t* payload = data + offset + RECORD_HEADER;
+            uint32_t payload_size;
+            std::memcpy(&payload_size, payload - 2 * sizeof(uint32_t),
+                sizeof(uint32_t));
+            const uint8_t* ptr = payload;
+            const uint8_t* end = payload + payload_size;
+            uint64_t idx, generation, result, len;
+            GetVarint(ptr, end, idx);
+            GetVarint(ptr, end, generation);
+            GetVarint(ptr, end, result);
+            GetVarint(ptr, end, len);
+            GameEntry game{game_idx, offset, positions.size(),
+                (int32_t)generation, (int32_t)result, (int32_t)len, 0};
+            for (uint32_t move = 0; move < len; move++) {
+                uint64_t offset = ptr - data;
+                uint64_t action, full = 1, searches = 0, n, value;
+                GetVarint(ptr, end, action);
+                if (has_full)
+                    GetVarint(ptr, end, full);
+                if (has_searches)
+                    GetVarint(ptr, end, searches);
+                GetVarint(ptr, end, n);
+                uint64_t visits = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    GetVarint(ptr, end, value);
+                    GetVarint(ptr, end, value);
+                    visits += value;
+                }
+                positions.push_back({offset, (uint32_t)games.size(),
+                    (uint16_t)move, (uint8_t)(full != 0), 0,
+                    (int32_t)(has_searches ? searches : visits)});
+            }
+            games.push_back(game);
+        }
+    }
+    else {
+        // written by Log::Save, the extension after the counts tells the
+        // logs with the generation, the full search flags and the searches
+        // from those of the original format
+        int32_t fields[4] = {};
+        std::memcpy(fields, data, std::min<size_t>(file.Size(), sizeof(fields)));
+        int32_t len = fields[2];
+        size_t body = (size_t)len * sizeof(int32_t) * (1 + flat);
+        if (fields[0] != SIZE || fields[1] != Board::DEPTH || len < 0
+            || file.Size() < sizeof(fields) + body)
+            throw std::runtime_error(fmt::format(
+                "{}: neither a shard nor a game log", file.path.string()));
+        uint64_t ext_offset = sizeof(fields) + body;
+        Log::Extension ext;
+        bool has_ext = false;
+        if (file.Size() > ext_offset) {
+            if (file.Size() >= ext_offset + sizeof(ext))
+                std::memcpy(&ext, data + ext_offset, sizeof(ext));
+            if (file.Size() < ext_offset + sizeof(ext)
+                || ext.magic != Log::Extension::MAGIC
+                || ext.version != Log::Extension::VERSION
+                || file.Size() != ext_offset + sizeof(ext) 
+                    + len * (1 + sizeof(int32_t)))
+                throw std::runtime_error(fmt::format(
+                    "{}: not a version {} game log extension", 
+                    file.path.string(), Log::Extension::VERSION));
+            has_ext = true;
+        }
+        bool has_full = has_ext, has_searches = has_ext;
+        int32_t generation = has_ext ? ext.generation : 0;
+        uint64_t actions = sizeof(fields);
+        uint64_t counts = actions + len * sizeof(int32_t);
+        games.push_back({0, actions, 0, generation, fields[3], len, 1});
+        // a single game per file, numbered like selfplay names them
+        std::string stem = file.path.stem().string();
+        if (!stem.empty() && std::all_of(stem.begin(), stem.end(), ::isdigit))
+            games.back().game_idx = std::stoll(stem);
+        const uint8_t* full = data + ext_offset + sizeof(ext);
+        const uint8_t* searches = full + len;
+        for (int32_t move = 0; move < len; move++) {
+            uint64_t row = counts + move * flat * sizeof(int32_t);
+            int32_t n_searches = 0;
+            if (has_searches) {
+                std::memcpy(&n_searches, searches + move * sizeof(int32_t),
+                    sizeof(int32_t));
+            }
+            else {
+                const int32_t* visits = (const int32_t*)(data + row);
+                n_searches = std::accumulate(visits, visits + flat, 0);
+            }
+            positions.push_back({row, 0, (uint16_t)move, 
+                (uint8_t)(has_full ? full[move] != 0 : 1), 0, n_searches});
+        }
+    }
+
+    IndexHeader header;
+    header.n_games = games.size();
+    header.n_positions = positions.size();
+    std::string index;
+    index.append((const char*)&header, sizeof(header));
+    index.append((const char*)games.data(), games.size() * sizeof(GameEntry));
+    index.append((const char*)positions.data(),
+        positions.size() * sizeof(PositionEntry));
+    return index;
+}
+
+
+size_t LogReader::FindSource(const std::vector<size_t>& base, size_t idx) const {
+    return std::upper_bound(base.begin(), base.end(), idx) - base.begin() - 1;
+}
+
+
+LogReader::Game LogReader::GetGame(size_t game) const {
+    if (game >= NumGames())
+        throw std::out_of_range(fmt::format(
+            "game {} of {}", game, NumGames()));
+    size_t src = FindSource(game_base, game);
+    const GameEntry& entry = sources[src].games[game - game_base[src]];
+    return {entry.game_idx, entry.generation, entry.result, entry.len};
+}
+
+
+LogReader::Position LogReader::GetPosition(size_t position) const {
+    if (position >= NumPositions())
+        throw std::out_of_range(fmt::format(
+            "position {} of {}", position, NumPositions()));
+    size_t src = FindSource(position_base, position);
+    const PositionEntry& entry
+        = sources[src].positions[position - position_base[src]];
+    return {game_base[src] + entry.game, (int)entry.move};
+}
+
+
+size_t LogReader::FirstPosition(size_t game) const {
+    if (game >= NumGames())
+        throw std::out_of_range(fmt::format(
+            "game {} of {}", game, NumGames()));
+    size_t src = FindSource(game_base, game);
+    return position_base[src]
+        + sources[src].games[game - game_base[src]].first_position;
+}
+
+
+const PositionEntry& LogReader::GetEntry(size_t game, int move,
+    const Source*& source, const GameEntry*& entry) const {
+    if (game >= NumGames())
+        throw std::out_of_range(fmt::format(
+            "game {} of {}", game, NumGames()));
+    size_t src = FindSource(game_base, game);
+    source = &sources[src];
+    entry = &source->games[game - game_base[src]];
+    if (move < 0 || move >= entry->len)
+        throw std::out_of_range(fmt::format(
+            "move {} of a {} move game", move, entry->len));
+    return source->positions[entry->first_position + move];
+}
+
+
+mcts::Action LogReader::GetAction(size_t game, int move) const {
+    const Source* source;
+    const GameEntry* entry;
+    const PositionEntry& position = GetEntry(game, move, source, entry);
+    const uint8_t* data = source->data->Data();
+    if (entry->dense) {
+        int32_t action;
+        std::memcpy(&action, data + entry->offset + move * sizeof(int32_t),
+            sizeof(int32_t));
+        return action;
+    }
+    const uint8_t* ptr = data + position.offset;
+    uint64_t action;
+    GetVarint(ptr, data + source->data->Size(), action);
+    return (mcts::Action)action;
+}
+
+
+Visits LogReader::GetVisits(size_t game, int move) const {
+    const Source* source;
+    const GameEntry* entry;
+    const PositionEntry& position = GetEntry(game, move, source, entry);
+    const uint8_t* data = source->data->Data();
+    if (entry->dense)
+        return Visits((const int32_t*)(data + position.offset));
+    const uint8_t* ptr = data + position.offset;
+    const uint8_t* end = data + source->data->Size();
+    uint64_t action, full, searches, n;
+    GetVarint(ptr, end, action);
+    if (((const ShardHeader*)data)->version >= 2)
+        GetVarint(ptr, end, full);
+    if (((const ShardHeader*)data)->version >= 3)
+        GetVarint(ptr, end, searches);
+    GetVarint(ptr, end, n);
+    return Visits(ptr, end, (int)n);
+}
+
+
+bool LogReader::FullSearch(size_t game, int move) const {
+    const Source* source;
+    const GameEntry* entry;
+    return GetEntry(game, move, source, entry).full;
+}
+
+
+int LogReader::Searches(size_t game, int move) const {
+    const Source* source;
+    const GameEntry* entry;
+    return GetEntry(game, move, source, entry).searches;
+}
+
+
+Board LogReader::Replay(size_t game, int move, int candidate_dist) const {
+    Board board(candidate_dist);
+    for (int i = 0; i < move; i++) {
+        board.Play(GetAction(game, i));
+    }
+    return board;
+}
+
+
+size_t LogReader::Sample(std::mt19937& gen) const {
+    if (NumPositions() == 0)
+        throw std::runtime_error("no positions to sample from");
+    return std::uniform_int_distribution<size_t>(0, NumPositions() - 1)(gen);
+}
+
+
+}
+}
@@ -0,0 +1,287 @@
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/format.h>
+#include "gomoku/replay_buffer.h"
+#include "gomoku/exporter.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+ReplayBuffer::ReplayBuffer(const ReplayBuffer::Config& conf)
+: config(conf), window(std::make_shared<Window>()) {
+    if (config.batch_size == 0 || config.prefetch == 0)
+        throw std::runtime_error(
+            "ReplayBuffer batch_size and prefetch must be positive");
+    Ingest();
+    ingester = std::thread(&ReplayBuffer::IngestThread, this);
+    for (size_t i = 0; i < std::max<size_t>(config.n_threads, 1); i++) {
+        samplers.emplace_back(&ReplayBuffer::SampleThread, this);
+    }
+}
+
+
+ReplayBuffer::~ReplayBuffer() {
+    Stop();
+}
+
+
+void ReplayBuffer::Stop() {
+    {
+        std::unique_lock<std::mutex> ready_lock(m_ready);
+        std::unique_lock<std::mutex> window_lock(m_window);
+        if (!running)
+            return;
+        running = false;
+    }
+    cv_ready.notify_all();
+    cv_space.notify_all();
+    cv_window.notify_all();
+    cv_poll.notify_all();
+    ingester.join();
+    for (std::thread& sampler: samplers) {
+        sampler.join();
+    }
+}
+
+
+bool ReplayBuffer::Next(ReplayBuffer::MiniBatch& batch) {
+    std::unique_lock<std::mutex> lock(m_ready);
+    cv_ready.wait(lock, [this] { return !ready.empty() || !running; });
+    if (ready.empty())
+        return false;
+    batch = std::move(ready.front());
+    ready.pop_front();
+    lock.unlock();
+    cv_space.notify_one();
+    return true;
+}
+
+
+size_t ReplayBuffer::NumGames() const {
+    std::unique_lock<std::mutex> lock(m_window);
+    return window->n_games;
+}
+
+
+size_t ReplayBuffer::NumPositions() const {
+    std::unique_lock<std::mutex> lock(m_window);
+    return window->base.back();
+}
+
+
+void ReplayBuffer::Ingest() {
+    std::unique_lock<std::mutex> lock(m_ingest);
+    std::vector<std::filesystem::path> paths;
+    for (const std::filesystem::path& dir: config.dirs) {
+        if (std::filesystem::exists(dir))
+            paths.push_back(dir);
+    }
+
+    bool changed = false;
+    for (const std::filesystem::path& path: LogReader::Collect(paths)) {
+        if (retired.count(path.string()))
+            continue;
+        // a file removed since it was listed is skipped
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path, ec);
+        if (ec)
+            continue;
+        std::filesystem::file_time_type time
+            = std::filesystem::last_write_time(path, ec);
+        if (ec)
+            continue;
+        auto it = std::find_if(files.begin(), files.end(),
+            [&](const File& file) { return file.path == path; });
+        if (it != files.end() && it->size == size && it->time == time)
+            continue;
+        std::shared_ptr<const LogReader> reader;
+        try {
+            // a grown shard only gets its new records indexed
+            if (it != files.end())
+                reader = std::make_shared<const LogReader>(
+                    path, *it->reader, config.save_index);
+            else
+                reader = std::make_shared<const LogReader>(
+                    std::vector<std::filesystem::path>{path}, 
+                    config.save_index);
+        }
+        catch (const std::exception&) {
+            // a game file still being written, tried again on the next poll
+            continue;
+        }
+        if (it != files.end()) {
+            // a shard that grew, earlier snapshots keep the old mapping
+            it->size = size;
+            it->time = time;
+            it->reader = std::move(reader);
+        }
+        else {
+            files.push_back({path, time, size, std::move(reader)});
+        }
+        changed = true;
+    }
+    if (!changed)
+        return;
+    std::sort(files.begin(), files.end(),
+        [](const File& a, const File& b) { return a.path < b.path; });
+
+    size_t n_dropped;
+    std::shared_ptr<const Window> next = BuildWindow(n_dropped);
+    // files entirely out of the window are never read again
+    for (size_t i = 0; i < n_dropped; i++) {
+        retired.insert(files[i].path.string());
+    }
+    files.erase(files.begin(), files.begin() + n_dropped);
+    {
+        std::unique_lock<std::mutex> window_lock(m_window);
+        window = std::move(next);
+    }
+    cv_window.notify_all();
+}
+
+
+std::shared_ptr<const ReplayBuffer::Window>
+ReplayBuffer::BuildWindow(size_t& n_dropped) const {
+    // newest files first, until a bound is reached
+    std::vector<Segment> segments;
+    size_t n_games = 0, n_positions = 0;
+    bool full = false;
+    n_dropped = 0;
+    for (auto file = files.rbegin(); file != files.rend(); file++) {
+        if (full) {
+            n_dropped = files.rend() - file;
+            break;
+        }
+        const LogReader& reader = *file->reader;
+        size_t first_game = reader.NumGames();
+        while (first_game > 0) {
+            size_t length = reader.GetGame(first_game - 1).length;
+            if (n_games > 0
+                && ((config.max_games > 0 && n_games + 1 > config.max_games)
+                    || (config.max_positions > 0
+                        && n_positions + length > config.max_positions))) {
+                full = true;
+                break;
+            }
+            first_game--;
+            n_games++;
+            n_positions += length;
+        }
+        if (first_game == reader.NumGames())
+            continue;
+        segments.push_back(
+            {file->reader, first_game, reader.FirstPosition(first_game)});
+    }
+    std::reverse(segments.begin(), segments.end());
+
+    std::shared_ptr<Window> window = std::make_shared<Window>();
+    for (Segment& segment: segments) {
+        window->base.push_back(window->base.back()
+            + segment.reader->NumPositions() - segment.first_position);
+        window->segments.push_back(std::move(segment));
+    }
+    window->n_games = n_games;
+    return window;
+}
+
+
+void ReplayBuffer::IngestThread() {
+    std::unique_lock<std::mutex> lock(m_window);
+    while (true) {
+        cv_poll.wait_for(
+            lock, std::chrono::duration<double>(config.poll_interval));
+        if (!running)
+            break;
+        lock.unlock();
+        Ingest();
+        lock.lock();
+    }
+}
+
+
+void ReplayBuffer::SampleThread() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    Batch batch;
+    while (true) {
+        std::shared_ptr<const Window> snapshot;
+        {
+            std::unique_lock<std::mutex> lock(m_window);
+            cv_window.wait(lock, [this] {
+                return !running || (window->base.back() > 0
+                    && window->base.back() >= config.min_positions);
+            });
+            if (!running)
+                return;
+            snapshot = window;
+        }
+
+        MiniBatch mini;
+        Sample(*snapshot, mini, batch, gen);
+
+        std::unique_lock<std::mutex> lock(m_ready);
+        cv_space.wait(lock, [this] {
+            return !running || ready.size() < config.prefetch;
+        });
+        if (!running)
+            return;
+        ready.push_back(std::move(mini));
+        lock.unlock();
+        cv_ready.notify_one();
+    }
+}
+
+
+void ReplayBuffer::Sample(const ReplayBuffer::Window& window,
+    ReplayBuffer::MiniBatch& mini, Batch& batch, std::mt19937& gen) const {
+    const int flat = SIZE * SIZE;
+    mini.size = config.batch_size;
+    mini.policies.resize(mini.size * flat);
+    mini.values.resize(mini.size);
+    mini.weights.resize(mini.size);
+    std::uniform_int_distribution<size_t> position_dist(
+        0, window.base.back() - 1);
+    std::uniform_int_distribution<int> sym_dist(0, N_SYMMETRIES - 1);
+
+    batch.Clear();
+    for (size_t i = 0; i < mini.size; i++) {
+        size_t idx = position_dist(gen);
+        size_t s = std::upper_bound(window.base.begin(), window.base.end(), idx)
+            - window.base.begin() - 1;
+        const Segment& segment = window.segments[s];
+        LogReader::Position position = segment.reader->GetPosition(
+            segment.first_position + idx - window.base[s]);
+        Board board = segment.reader->Replay(position.game, position.move);
+        int sym = config.augment ? sym_dist(gen) : 0;
+        batch.Push(MakeSample(*segment.reader, position.game, position.move,
+            board, sym, mini.policies.data() + i * flat, mini.values[i],
+            mini.weights[i]));
+    }
+    batch.Expand();
+    mini.states = batch.states;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const ReplayBuffer::Config& cfg) {
+    out << "ReplayBuffer::Config(" << "\n    ";
+    out << "dirs: ";
+    for (const std::filesystem::path& dir: cfg.dirs)
+        out << dir << " ";
+    out << "\n    ";
+    out << "max_games: " << cfg.max_games << "\n    ";
+    out << "max_positions: " << cfg.max_positions << "\n    ";
+    out << "min_positions: " << cfg.min_positions << "\n    ";
+    out << "batch_size: " << cfg.batch_size << "\n    ";
+    out << "n_threads: " << cfg.n_threads << "\n    ";
+    out << "prefetch: " << cfg.prefetch << "\n    ";
+    out << "augment: " << cfg.augment << "\n    ";
+    out << "poll_interval: " << cfg.poll_interval;
+    out << ")";
+    return out;
+}
+
+
+}
+}
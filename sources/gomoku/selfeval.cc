@@ -0,0 +1,428 @@
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <fmt/format.h>
+#include "gomoku/selfeval.h"
+#include "gomoku/logger.h"
+#include "gomoku/shard.h"
+
+
+
+namespace gomoku {
+namespace selfeval {
+
+
+thread_local std::mt19937 gen(std::random_device{}());
+
+
+static double EloToScore(double elo) {
+    return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+
+static double ScoreToElo(double score) {
+    score = std::clamp(score, 1e-3, 1 - 1e-3);
+    return -400 * std::log10(1 / score - 1);
+}
+
+
+SPRT::SPRT(const SPRT::Config& conf): config(conf) {}
+
+
+void SPRT::Add(double score) {
+    if (score >= 1)
+        wins++;
+    else if (score <= 0)
+        losses++;
+    else
+        draws++;
+}
+
+
+double SPRT::LLR() const {
+    int n = wins + draws + losses;
+    if (n == 0)
+        return 0;
+    // a win and a loss are added to the variance, so that a few one-sided
+    // results do not make it vanish and end the test right away
+    double s = (wins + 0.5 * draws) / n;
+    double prior_s = (wins + 1 + 0.5 * draws) / (n + 2);
+    double var = ((wins + 1) * std::pow(1 - prior_s, 2)
+        + draws * std::pow(0.5 - prior_s, 2)
+        + (losses + 1) * std::pow(prior_s, 2)) / (n + 2);
+    double s0 = EloToScore(config.elo0);
+    double s1 = EloToScore(config.elo1);
+    return n * (s1 - s0) * (2 * s - s0 - s1) / (2 * var);
+}
+
+
+double SPRT::LowerBound() const {
+    return std::log(config.beta / (1 - config.alpha));
+}
+
+
+double SPRT::UpperBound() const {
+    return std::log((1 - config.beta) / config.alpha);
+}
+
+
+SPRT::Result SPRT::Decide() const {
+    double llr = LLR();
+    if (llr >= UpperBound())
+        return Result::H1;
+    if (llr <= LowerBound())
+        return Result::H0;
+    return Result::NONE;
+}
+
+
+std::pair<double, double> SPRT::Elo() const {
+    int n = wins + draws + losses;
+    if (n == 0)
+        return {0, 0};
+    double s = (wins + 0.5 * draws) / n;
+    double var = (wins * std::pow(1 - s, 2) + draws * std::pow(0.5 - s, 2)
+        + losses * std::pow(s, 2)) / n;
+    double margin = 1.96 * std::sqrt(var / n);
+    return {ScoreToElo(s),
+        (ScoreToElo(s + margin) - ScoreToElo(s - margin)) / 2};
+}
+
+
+Server::Server(const Server::Config& cfg)
+: config(cfg), loader(LoaderConfig()), sprt(cfg.sprt_cfg) {
+    logger::ShardWriter::Config shard_cfg;
+    shard_cfg.dir = config.out_dir / "shards";
+    writer = std::make_unique<logger::AsyncWriter>(
+        logger::AsyncWriter::Config(),
+        std::make_unique<logger::ShardWriter>(shard_cfg));
+}
+
+
+ReplicaLoader::Config Server::LoaderConfig() const {
+    ReplicaLoader::Config loader_cfg = config.ld_cfg;
+    loader_cfg.max_batch = config.eq_cfg.max_batch;
+    return loader_cfg;
+}
+
+
+void Server::LoadEvauator() {
+    std::cout << "===== Load Evaluators =====" << std::endl;
+    const AgentConfig* agents[2] = {&config.agent1, &config.agent2};
+    for (int i = 0; i < 2; i++) {
+        // both models are behind queues of their own, batched over all games
+        std::filesystem::path model
+            = std::filesystem::canonical(agents[i]->model_path);
+        std::cout << fmt::format("agent{}: {}", i + 1, model.string())
+            << std::endl;
+        std::vector<EvaluationQueue::Evaluator> evs
+            = loader.Load(model, std::cout);
+        evaluators[i] = std::make_unique<EvaluationQueue>(
+            std::move(evs), config.eq_cfg,
+            std::max(ReplicaLoader::ModelGeneration(model), 0));
+    }
+    std::cout << "===== Evaluators Loaded =====" << std::endl;
+}
+
+
+SPRT::Result Server::Run() {
+    std::cout << "===== Running Selfeval =====" << std::endl;
+    master_pbar = std::make_unique<pb::BlockProgressBar>(
+        pb::option::PrefixText(
+            fmt::format("[{:>4}/{:>4}]", 0, config.max_games)),
+        pb::option::BarWidth{25},
+        pb::option::Start{"["},
+        pb::option::End{"]"},
+        pb::option::ShowElapsedTime{true},
+        pb::option::MaxProgress(config.max_games)
+    );
+    master_pbar->print_progress();
+
+    game_idx.store(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.n_workers; i++) {
+        workers.emplace_back(&Server::ThreadJob, this);
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    writer->Close();
+
+    auto [elo, margin] = sprt.Elo();
+    std::cout << fmt::format(
+        "\nagent1 against agent2: {} wins, {} draws, {} losses",
+        sprt.wins, sprt.draws, sprt.losses) << "\n";
+    std::cout << fmt::format("elo: {:+.1f} +- {:.1f} (95%)", elo, margin)
+        << "\n";
+    std::cout << fmt::format("LLR: {:.2f} [{:.2f}, {:.2f}], ",
+        sprt.LLR(), sprt.LowerBound(), sprt.UpperBound()) << result << "\n";
+    std::cout << "===== Selfeval Completed =====" << std::endl;
+    return result;
+}
+
+
+void Server::ThreadJob() {
+    int g_idx;
+    while (!decided.load()
+        && (g_idx = game_idx.fetch_add(1)) < config.max_games) {
+        double score = SingleGame(g_idx);
+        if (score < 0)
+            break;
+
+        std::unique_lock<std::mutex> lock(m_master);
+        // games finishing after the decision are not counted
+        if (decided.load())
+            break;
+        sprt.Add(score);
+        result = sprt.Decide();
+        if (result != SPRT::Result::NONE)
+            decided.store(true);
+        int n = sprt.wins + sprt.draws + sprt.losses;
+        master_pbar->set_option(pb::option::PrefixText(
+            fmt::format("[{:>4}/{:>4}]", n, config.max_games)));
+        master_pbar->set_option(pb::option::PostfixText(fmt::format(
+            "W {} D {} L {}, LLR {:.2f}",
+            sprt.wins, sprt.draws, sprt.losses, sprt.LLR())));
+        master_pbar->tick();
+    }
+}
+
+
+double Server::SingleGame(int game_idx) {
+    // agent1 plays black in even games and white in odd ones
+    int black = game_idx % 2;
+    const AgentConfig* agents[2] = {&config.agent1, &config.agent2};
+
+    Board board(config.candidate_dist);
+    std::unique_ptr<MCTS> trees[2];
+    for (int i = 0; i < 2; i++) {
+        trees[i] = std::make_unique<MCTS>(
+            board, *evaluators[i], agents[i]->mcts_cfg);
+    }
+    std::vector<mcts::Action> actions;
+    std::vector<std::vector<int>> counts;
+
+    while (!board.Terminated()) {
+        if (decided.load())
+            return -1;
+        int game_len = actions.size();
+        int agent = (board.GetTurn() == BLACK) ? black : 1 - black;
+        MCTS& tree = *trees[agent];
+        // every move is searched from scratch by the agent to play it
+        if (game_len > 0) {
+            tree.Reset(board);
+            tree.Search(agents[agent]->compute_budget);
+        }
+        std::vector<MCTS::ActionInfo> action_infos = tree.GetActionInfos();
+        mcts::Action move = SelectMove(action_infos, game_len);
+        board.Play(move);
+
+        actions.push_back(move);
+        std::vector<int> single_counts(SIZE * SIZE, 0);
+        for (const MCTS::ActionInfo& info: action_infos) {
+            single_counts[info.action] = info.n;
+        }
+        counts.emplace_back(std::move(single_counts));
+    }
+
+    Board::State state = board.GetState();
+    writer->WriteGame(logger::Log(actions.size(), state, actions, counts),
+        game_idx, config.out_dir / fmt::format("{:04d}.bin", game_idx));
+    if (state == Board::State::DRAW)
+        return 0.5;
+    bool black_win = state == Board::State::BLACK_WIN;
+    return (black_win == (black == 0)) ? 1 : 0;
+}
+
+
+mcts::Action Server::SelectMove(
+    const std::vector<MCTS::ActionInfo>& infos, int turn) const {
+    std::vector<int> weights(infos.size(), 0);
+    if (turn < config.sample_steps) {
+        for (int i = 0; i < infos.size(); i++) {
+            weights[i] = infos[i].n;
+        }
+    }
+    else {
+        int n_max = std::max_element(
+            infos.begin(), infos.end(),
+            [](const MCTS::ActionInfo& a, const MCTS::ActionInfo& b) {
+                return a.n < b.n;
+            })->n;
+        for (int i = 0; i < infos.size(); i++) {
+            if (infos[i].n == n_max)
+                weights[i] = 1;
+        }
+    }
+    std::discrete_distribution<int> sampler(weights.begin(), weights.end());
+    return infos[sampler(gen)].action;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const AgentConfig& cfg) {
+    out << "AgentConfig(" << "\n    ";
+    out << "model_path: " << cfg.model_path << "\n    ";
+    out << "compute_budget: " << cfg.compute_budget << "\n    ";
+    out << "mcts: " << cfg.mcts_cfg;
+    out << ")";
+    return out;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const SPRT::Config& cfg) {
+    out << "SPRT::Config(" << "\n    ";
+    out << "elo0: " << cfg.elo0 << "\n    ";
+    out << "elo1: " << cfg.elo1 << "\n    ";
+    out << "alpha: " << cfg.alpha << "\n    ";
+    out << "beta: " << cfg.beta;
+    out << ")";
+    return out;
+}
+
+
+std::ostream& operator<<(std::ostream& out, SPRT::Result result) {
+    switch (result) {
+        case SPRT::Result::NONE:
+            return out << "undecided";
+        case SPRT::Result::H0:
+            return out << "H0 accepted, agent1 fails";
+        case SPRT::Result::H1:
+            return out << "H1 accepted, agent1 passes";
+    }
+    return out;
+}
+
+
+std::ostream& operator<<(std::ostream& out, const Server::Config& cfg) {
+    out << "agent1: " << cfg.agent1 << "\n";
+    out << "agent2: " << cfg.agent2 << "\n";
+    out << "output dir: " << cfg.out_dir << "\n";
+    out << "max games: " << cfg.max_games << "\n";
+    out << "num workers: " << cfg.n_workers << "\n";
+    out << "num evaluators per agent: " << cfg.ld_cfg.n_evaluators << "\n";
+    out << "warmup iterations: " << cfg.ld_cfg.warmup_iters << "\n";
+    out << "sample steps: " << cfg.sample_steps << "\n";
+    out << "candidate distance: " << cfg.candidate_dist << "\n";
+    out << "evaluator config: " << cfg.ld_cfg.ev_cfg << "\n";
+    out << "eval queue config: " << cfg.eq_cfg << "\n";
+    out << "sprt config: " << cfg.sprt_cfg;
+    return out;
+}
+
+
+boost::program_options::options_description
+GetSelfevalConfig(Server::Config& cfg) {
+    boost::program_options::options_description desc("Selfeval config");
+    desc.add_options()
+        (
+            "model1", 
+            boost::program_options::value<std::filesystem::path>
+                (&cfg.agent1.model_path)->required(), 
+            "model under test, torch jit module or native weight file"
+        )
+        (
+            "model2", 
+            boost::program_options::value<std::filesystem::path>
+                (&cfg.agent2.model_path)->required(), 
+            "model to compare against"
+        )
+        (
+            "n_searches1", 
+            boost::program_options::value<size_t>(&cfg.agent1.compute_budget)
+                ->default_value(800),
+            "number of MCTS searches per move of model1"
+        )
+        (
+            "n_searches2", 
+            boost::program_options::value<size_t>(&cfg.agent2.compute_budget)
+                ->default_value(800),
+            "number of MCTS searches per move of model2"
+        )
+        (
+            "out_dir", 
+            boost::program_options::value<std::filesystem::path>
+                (&cfg.out_dir)->required(), 
+            "directory the games are written to"
+        )
+        (
+            "max_games", 
+            boost::program_options::value<size_t>(&cfg.max_games)
+                ->default_value(400),
+            "games played at most when the test does not decide earlier"
+        )
+        (
+            "n_workers", 
+            boost::program_options::value<size_t>(&cfg.n_workers)
+                ->default_value(8),
+            "number of games played simultaneously"
+        )
+        (
+            "n_evaluators", 
+            boost::program_options::value<size_t>(&cfg.ld_cfg.n_evaluators)
+                ->default_value(1),
+            "number of evaluator replicas of each model"
+        )
+        (
+            "replica_threads", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.ld_cfg.replica_threads)->multitoken(),
+            "intra-op threads of each evaluator replica, one value for all "
+            "or one per replica"
+        )
+        (
+            "warmup_iters", 
+            boost::program_options::value<int>(&cfg.ld_cfg.warmup_iters)
+                ->default_value(5),
+            "passes over the warmup batch sizes before the games start, "
+            "0 to skip"
+        )
+        (
+            "warmup_batches", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.ld_cfg.warmup_batches)->multitoken(),
+            "batch sizes to warm up on, defaults to powers of two up to "
+            "max_batch"
+        )
+        (
+            "sample_steps", 
+            boost::program_options::value<size_t>(&cfg.sample_steps)
+                ->default_value(4),
+            "number of opening moves sampled by visit counts"
+        )
+        (
+            "candidate_dist", 
+            boost::program_options::value<int>(&cfg.candidate_dist)
+                ->default_value(0),
+            "only search moves within this distance of a stone, 0 for all"
+        )
+        (
+            "elo0", 
+            boost::program_options::value<double>(&cfg.sprt_cfg.elo0)
+                ->default_value(0),
+            "elo of model1 over model2 under H0, accepting it fails model1"
+        )
+        (
+            "elo1", 
+            boost::program_options::value<double>(&cfg.sprt_cfg.elo1)
+                ->default_value(10),
+            "elo of model1 over model2 under H1, accepting it passes model1"
+        )
+        (
+            "alpha", 
+            boost::program_options::value<double>(&cfg.sprt_cfg.alpha)
+                ->default_value(0.05),
+            "probability of passing model1 when H0 holds"
+        )
+        (
+            "beta", 
+            boost::program_options::value<double>(&cfg.sprt_cfg.beta)
+                ->default_value(0.05),
+            "probability of failing model1 when H1 holds"
+        )
+    ;
+    return desc;
+}
+
+
+}
+}
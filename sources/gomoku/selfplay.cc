@@ -1,7 +1,9 @@
 
+#include <cmath>
 #include <chrono>
+#include <fstream>
 #include <algorithm>
-#include <torch/torch.h>
+#include <sstream>
 #include <fmt/format.h>
 #include "gomoku/selfplay.h"
 #include "gomoku/board.h"
@@ -14,38 +16,282 @@ namespace selfplay {
 
 
 thread_local std::mt19937 gen(std::random_device{}());
+// steps of an adaptive budget per compute_budget
+const static int BUDGET_STEPS = 8;
+// set from signal handlers, so it has to be lock-free
+std::atomic<bool> reload_requested = false;
+static_assert(std::atomic<bool>::is_always_lock_free);
 
 
-Server::Server(const Server::Config& cfg): config(cfg) {
+Server::Server(const Server::Config& cfg)
+: config(cfg), loader(LoaderConfig()), book(BookConfig()) {
     out_state_dir = config.out_dir / "state";
     out_txt_dir = config.out_dir / "txt";
-    std::filesystem::create_directories(out_state_dir);
-    std::filesystem::create_directories(out_txt_dir);
+    if (config.verbosity > 0)
+        std::filesystem::create_directories(out_txt_dir);
+    std::unique_ptr<logger::ShardWriter> shards;
+    if (config.shard_mb > 0) {
+        logger::ShardWriter::Config shard_cfg;
+        shard_cfg.dir = config.out_dir / "shards";
+        shard_cfg.max_bytes = config.shard_mb << 20;
+        shard_cfg.sync = config.shard_sync;
+        shards = std::make_unique<logger::ShardWriter>(shard_cfg);
+    }
+    else {
+        std::filesystem::create_directories(out_state_dir);
+    }
+    logger::AsyncWriter::Config writer_cfg;
+    writer_cfg.max_pending = config.write_queue;
+    writer = std::make_unique<logger::AsyncWriter>(
+        writer_cfg, std::move(shards));
 }
 
 
 void Server::LoadEvauator() {
     std::cout << "===== Load Evaluator =====" << std::endl;
-    
-    torch::jit::script::Module model(torch::jit::load(config.model_path));
 
-    std::unique_ptr<GomokuEvaluator> ev = 
-        std::make_unique<GomokuEvaluator>(std::move(model));
-    evaluator = std::make_unique<EvaluationQueue>(std::move(ev));
+    if (!config.shm_name.empty()) {
+        // the inference server owns the model, warmup and reloads
+        remote = std::make_unique<ShmEvaluator>(
+            config.shm_name, config.eq_cfg.symmetry);
+        std::cout << fmt::format("inference server {}, generation {}", 
+            config.shm_name, remote->Generation()) << std::endl;
+        std::cout << "===== Evaluator Loaded =====" << std::endl;
+        return;
+    }
+
+    if (config.model_path.empty())
+        throw std::runtime_error("model_path is required without shm_name");
+    model_file = std::filesystem::canonical(config.model_path);
+    model_time = std::filesystem::last_write_time(model_file);
+    generation = std::max(ReplicaLoader::ModelGeneration(model_file), 0);
+    std::cout << fmt::format("{}, generation {}", 
+        model_file.string(), generation) << std::endl;
+
+    // warmed up here so that early games are not searched with slow batches
+    std::vector<EvaluationQueue::Evaluator> evs 
+        = loader.Load(model_file, std::cout);
+    loader.Report(*evs.front(), std::cout);
+    evaluator = std::make_unique<EvaluationQueue>(
+        std::move(evs), config.eq_cfg, generation);
 
     std::cout << "===== Evaluator Loaded =====" << std::endl;
 }
 
+
+ReplicaLoader::Config Server::LoaderConfig() const {
+    ReplicaLoader::Config loader_cfg;
+    loader_cfg.ev_cfg = config.ev_cfg;
+    loader_cfg.n_evaluators = config.n_evaluators;
+    loader_cfg.replica_threads = config.replica_threads;
+    loader_cfg.warmup_iters = config.warmup_iters;
+    loader_cfg.warmup_batches = config.warmup_batches;
+    loader_cfg.report_batches = config.report_batches;
+    loader_cfg.max_batch = config.eq_cfg.max_batch;
+    return loader_cfg;
+}
+
+
+OpeningBook::Config Server::BookConfig() const {
+    OpeningBook::Config book_cfg;
+    book_cfg.max_stones = config.sp_cfg.opening_stones;
+    book_cfg.max_visits = config.sp_cfg.opening_visits;
+    return book_cfg;
+}
+
+
+mcts::EvaluatorBase& Server::Evaluator() const {
+    if (remote)
+        return *remote;
+    return *evaluator;
+}
+
+
+int Server::Generation() const {
+    if (remote)
+        return remote->Generation();
+    return evaluator->Generation();
+}
+
+
+void Server::RequestReload() {
+    reload_requested.store(true);
+}
+
+
+void Server::WatchThread() {
+    std::chrono::steady_clock::time_point last_poll 
+        = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_watch);
+    while (true) {
+        cv_watch.wait_for(lock, std::chrono::milliseconds(200));
+        if (!watching)
+            break;
+        bool reload = reload_requested.exchange(false);
+        std::chrono::steady_clock::time_point now 
+            = std::chrono::steady_clock::now();
+        if (!reload && config.reload_interval > 0 
+            && now - last_poll 
+                >= std::chrono::duration<double>(config.reload_interval)) {
+            last_poll = now;
+            reload = ModelChanged();
+        }
+        if (reload) {
+            // loading takes a while, games keep running on the old model
+            lock.unlock();
+            ReloadEvaluator();
+            lock.lock();
+        }
+    }
+}
+
+
+bool Server::ModelChanged() {
+    std::error_code ec;
+    std::filesystem::path file 
+        = std::filesystem::canonical(config.model_path, ec);
+    if (ec)
+        return false;
+    std::filesystem::file_time_type time 
+        = std::filesystem::last_write_time(file, ec);
+    if (ec || (file == model_file && time == model_time))
+        return false;
+    // a checkpoint still being written keeps changing, reload only once
+    // two polls in a row see the same file
+    bool settled = (file == seen_file && time == seen_time);
+    seen_file = file;
+    seen_time = time;
+    return settled;
+}
+
+
+void Server::ReloadEvaluator() {
+    std::error_code ec;
+    std::filesystem::path file 
+        = std::filesystem::canonical(config.model_path, ec);
+    if (ec) {
+        std::cerr << fmt::format("reload: cannot resolve {}: {}", 
+            config.model_path.string(), ec.message()) << std::endl;
+        return;
+    }
+    std::filesystem::file_time_type time 
+        = std::filesystem::last_write_time(file, ec);
+    int next_generation = ReplicaLoader::ModelGeneration(file);
+    if (next_generation < 0)
+        next_generation = generation + 1;
+
+    // a broken checkpoint is not retried until it is written again
+    model_file = file;
+    model_time = time;
+    try {
+        std::ostringstream log;
+        evaluator->Reload(loader.Load(file, log), next_generation);
+    }
+    catch (const std::exception& e) {
+        std::cerr << fmt::format("reload: cannot load {}: {}", 
+            file.string(), e.what()) << std::endl;
+        return;
+    }
+    generation = next_generation;
+}
+
+
 void Server::ThreadJob(int pbar_idx) {
     int g_idx;
     while ((g_idx = game_idx.fetch_add(1)) < config.max_games) {
         SingleSelfplay(g_idx, pbar_idx);
-        {
-            std::unique_lock<std::mutex> lock(m_master);
-            done++;
-            master_pbar->set_option(pb::option::PrefixText(
-                fmt::format("[{:>4}/{:>4}]", done, total)));
-            master_pbar->tick();
+    }
+    pbar[pbar_idx].set_option(pb::option::PostfixText("Done")); 
+    pbar[pbar_idx].mark_as_completed();
+}
+
+
+void Server::DriverJob(int pbar_idx) {
+    // the trees have no search threads of their own, a leaf of every game
+    // is selected and they are all evaluated as one batch
+    MCTS::Config mcts_cfg = config.mcts_cfg;
+    mcts_cfg.n_threads = 0;
+    std::vector<std::unique_ptr<Game>> games;
+    std::vector<MCTS::Leaf> leaves;
+    std::vector<Game*> owners;
+    std::vector<bool> counted;
+    std::vector<const mcts::StateBase*> states;
+    std::vector<mcts::EvalHint> hints;
+    bool exhausted = false;
+    // for the progress bar, since it was last updated
+    size_t n_moves = 0, n_batches = 0, n_leaves = 0;
+
+    while (true) {
+        while (!exhausted && games.size() < config.games_per_worker) {
+            int g_idx = game_idx.fetch_add(1);
+            if (g_idx >= config.max_games) {
+                exhausted = true;
+                break;
+            }
+            games.push_back(StartGame(g_idx, mcts_cfg, false));
+            StartMove(*games.back());
+        }
+        if (games.empty())
+            break;
+
+        leaves.resize(games.size());
+        owners.clear();
+        counted.clear();
+        states.clear();
+        hints.clear();
+        for (std::unique_ptr<Game>& game: games) {
+            // the root expansion is not part of the budget, as with Search
+            bool expanded = game->tree->RootExpanded();
+            if (expanded && game->searched >= game->budget)
+                continue;
+            MCTS::Leaf& leaf = leaves[owners.size()];
+            if (!game->tree->SelectLeaf(
+                    leaf, game->budget - game->searched)) {
+                game->searched += expanded;
+                continue;
+            }
+            owners.push_back(game.get());
+            counted.push_back(expanded);
+            states.push_back(leaf.state.get());
+            hints.push_back(leaf.hint);
+        }
+        if (!states.empty()) {
+            std::vector<mcts::Evaluation> outputs 
+                = Evaluator().EvaluateBatch(states, hints);
+            for (int i = 0; i < owners.size(); i++) {
+                owners[i]->tree->BackupLeaf(leaves[i], outputs[i]);
+                owners[i]->searched += counted[i];
+            }
+            n_batches++;
+            n_leaves += states.size();
+        }
+
+        for (int i = 0; i < games.size(); i++) {
+            Game& game = *games[i];
+            if (!game.tree->RootExpanded())
+                continue;
+            if (!game.prepared)
+                PrepareRoot(game);
+            AdaptBudget(game);
+            if (game.searched < game.budget)
+                continue;
+            n_moves++;
+            if (EndMove(game)) {
+                StartMove(game);
+                continue;
+            }
+            EndGame(game);
+            games.erase(games.begin() + i--);
+        }
+
+        if (n_moves >= games.size()) {
+            pbar[pbar_idx].set_option(pb::option::PostfixText(fmt::format(
+                "{} games - {:.1f} leaves per batch", games.size(), 
+                (double)n_leaves / std::max<size_t>(n_batches, 1)))); 
+            pbar[pbar_idx].print_progress();
+            n_moves = 0;
+            n_batches = 0;
+            n_leaves = 0;
         }
     }
     pbar[pbar_idx].set_option(pb::option::PostfixText("Done")); 
@@ -86,14 +332,48 @@ void Server::Run() {
     );
     master_pbar->print_progress();
 
+    watching = true;
+    if (evaluator)
+        watcher = std::thread(&Server::WatchThread, this);
+
     game_idx.store(config.starting_index);
     std::vector<std::thread> workers;
     for (int i = 0; i < config.n_workers; i++) {
-        workers.emplace_back(&Server::ThreadJob, this, i);
+        if (config.games_per_worker > 0)
+            workers.emplace_back(&Server::DriverJob, this, i);
+        else
+            workers.emplace_back(&Server::ThreadJob, this, i);
     }
     for (auto& worker: workers) {
         worker.join();
     }
+    {
+        std::unique_lock<std::mutex> lock(m_watch);
+        watching = false;
+    }
+    cv_watch.notify_all();
+    if (watcher.joinable())
+        watcher.join();
+    writer->Close();
+    if (config.sp_cfg.resign_threshold > -1) {
+        std::cout << fmt::format(
+            "\nresigned: {}, played out past a resignation: {}, "
+            "false resignations: {} ({:.1f}%)", 
+            n_resigned, n_would_resign, n_false_resign, 
+            100.0 * n_false_resign / std::max(n_would_resign, 1));
+    }
+    if (config.sp_cfg.adaptive_budget) {
+        std::cout << fmt::format(
+            "\nadaptive budget: {:.1f} searches per full move of {}", 
+            (double)n_full_searches / std::max<int64_t>(n_full_moves, 1), 
+            config.sp_cfg.compute_budget);
+    }
+    if (config.sp_cfg.opening_stones > 0) {
+        std::cout << fmt::format(
+            "\nopening book: {} positions, {} of {} shallow moves "
+            "started from it", 
+            book.NumPositions(), book.NumHits(), book.NumLookups());
+    }
     // pb::show_console_cursor(true);
     std::cout << std::endl;
     std::cout << "===== Selfplay Completed =====" << std::endl;
@@ -101,80 +381,269 @@ void Server::Run() {
 
 
 int Server::SingleSelfplay(int game_idx, int pbar_idx) {
-    std::ofstream out(
-        out_txt_dir / fmt::format("{:04d}.txt", game_idx), std::ios::out);
+    std::unique_ptr<Game> game = StartGame(game_idx, config.mcts_cfg, true);
+    do {
+        pbar[pbar_idx].set_option(pb::option::PostfixText(fmt::format(
+            "Game {} - Turn {}", game_idx, game->actions.size()))); 
+        pbar[pbar_idx].print_progress();
+
+        StartMove(*game);
+        PrepareRoot(*game);
+        while (game->searched < game->budget) {
+            game->tree->Search(game->budget - game->searched);
+            game->searched = game->budget;
+            AdaptBudget(*game);
+        }
+    } while (EndMove(*game));
+
+    pbar[pbar_idx].set_option(pb::option::PostfixText(
+        fmt::format("Game {} - Ended", game_idx))); 
+    EndGame(*game);
+    return 0;
+}
 
-    std::vector<Action> actions;
-    std::vector<std::vector<int>> counts;
-    SelfplayConfig cfg = config.sp_cfg;
 
-    Board board;
-    MCTS tree(board, *evaluator, config.mcts_cfg);
+std::unique_ptr<Server::Game> Server::StartGame(
+    int game_idx, const MCTS::Config& mcts_cfg, bool expand) {
+    const SelfplayConfig& cfg = config.sp_cfg;
+    std::unique_ptr<Game> game = std::make_unique<Game>();
+    game->idx = game_idx;
+    game->board = Board(cfg.candidate_dist);
+    game->tree = std::make_unique<MCTS>(
+        game->board, Evaluator(), mcts_cfg, expand);
+    game->start_generation = Generation();
+    game->expand = expand;
+    game->can_resign = cfg.resign_threshold > -1 
+        && std::uniform_real_distribution<double>(0, 1)(gen) 
+            >= cfg.resign_playout;
+    game->total_st = std::chrono::system_clock::now();
+    return game;
+}
 
-    std::chrono::system_clock::time_point st, ed, total_st, total_ed;
-    std::vector<MCTS::ActionInfo> action_infos;
-    int game_len = 0;
 
-    total_st = std::chrono::system_clock::now();
-    while (!board.Terminated()) {
-        pbar[pbar_idx].set_option(pb::option::PostfixText(
-            fmt::format("Game {} - Turn {}", game_idx, game_len))); 
-        pbar[pbar_idx].print_progress();
+void Server::StartMove(Server::Game& game) {
+    const SelfplayConfig& cfg = config.sp_cfg;
+    size_t game_len = game.actions.size();
+    game.full = cfg.full_search_prob >= 1 
+        || std::uniform_real_distribution<double>(0, 1)(gen) 
+            < cfg.full_search_prob;
+    game.noise = game.full && game_len < cfg.noise_steps;
+    game.budget = 0;
+    if (game_len > 0)
+        game.budget = game.full ? cfg.compute_budget : cfg.fast_budget;
+    if (game_len > 0 && game.full && cfg.adaptive_budget) {
+        // searched in steps from the least a move gets
+        game.bank += cfg.compute_budget;
+        game.budget = std::max<size_t>(cfg.min_budget * cfg.compute_budget, 1);
+    }
+    game.searched = 0;
+    game.prepared = false;
+    game.book = game.full && game_len > 0 && book.Covers(game_len);
+    game.book_stats.clear();
+    game.book_visits = 0;
+    game.st = std::chrono::system_clock::now();
+}
 
-        if (game_len < cfg.noise_steps) {
-            tree.ApplyRootNoise(cfg.noise_alpha, cfg.noise_eps);
-        }
-        st = std::chrono::system_clock::now();
-        if (game_len > 0) {
-            tree.Search(cfg.compute_budget);
+
+void Server::PrepareRoot(Server::Game& game) {
+    const SelfplayConfig& cfg = config.sp_cfg;
+    if (game.book) {
+        game.book_generation = Generation();
+        game.book_stats = book.Lookup(game.actions, game.book_generation);
+        game.tree->AddRootStats(game.book_stats);
+        for (const MCTS::ChildStats& child: game.book_stats) {
+            game.book_visits += child.n;
         }
-        ed = std::chrono::system_clock::now();
-
-        action_infos = tree.GetActionInfos();
-        // Action best = tree.GetBestAction();
-        Action move = SelectMove(action_infos, game_len);
-
-        board.Play(move);
-        out << board << '\n';
-        out << fmt::format("action: {:>3}, search time: {:.4f} sec\n",
-            Coord2String(Action2Coord(move)), 
-            std::chrono::duration<double>(ed - st).count());
-        ShowTopActions(action_infos, 5, out);
-        out << std::endl;
-        tree.Play(move);
-        tree.Reset(board);
-        game_len++;
-
-        actions.push_back(move);
-        std::vector<int> single_counts(SIZE * SIZE, 0);
-        for (const MCTS::ActionInfo& info: action_infos) {
-            single_counts[info.action] = info.n;
+        // the book visits count towards the budget, the rest is topped up
+        size_t top_up = std::max<size_t>(cfg.opening_top_up * game.budget, 1);
+        game.budget = std::max<int64_t>(
+            (int64_t)game.budget - game.book_visits, top_up);
+    }
+    // noise goes on the priors alone, the book never sees it
+    if (game.noise) {
+        game.tree->ApplyRootNoise(cfg.noise_alpha, cfg.noise_eps);
+        game.noise = false;
+    }
+    game.prepared = true;
+}
+
+
+void Server::AdaptBudget(Server::Game& game) const {
+    const SelfplayConfig& cfg = config.sp_cfg;
+    if (!cfg.adaptive_budget || !game.full || game.budget == 0 
+        || game.searched < game.budget)
+        return;
+    int64_t cap = std::min<int64_t>(
+        cfg.max_budget * cfg.compute_budget, game.bank);
+    if ((int64_t)game.searched >= cap)
+        return;
+    std::vector<MCTS::ActionInfo> infos = game.tree->GetActionInfos();
+    if (infos.size() < 2)
+        return;
+    // a move started from the opening book is extended on the visits of
+    // its own searches, the book visits already stand in for the searches
+    // up to compute_budget, q keeps the pooled estimate
+    for (MCTS::ActionInfo& info: infos) {
+        for (const MCTS::ChildStats& seeded: game.book_stats) {
+            if (seeded.action == info.action)
+                info.n -= seeded.n;
         }
-        counts.emplace_back(std::move(single_counts));
     }
 
-    total_ed = std::chrono::system_clock::now();
-    pbar[pbar_idx].set_option(pb::option::PostfixText(
-        fmt::format("Game {} - Ended", game_idx))); 
+    std::partial_sort(infos.begin(), infos.begin() + 2, infos.end(), 
+        [](const MCTS::ActionInfo& a, const MCTS::ActionInfo& b) {
+            return a.n > b.n;
+        });
+    const MCTS::ActionInfo& first = infos[0];
+    const MCTS::ActionInfo& second = infos[1];
+    Prob max_p = std::max_element(infos.begin(), infos.end(), 
+        [](const MCTS::ActionInfo& a, const MCTS::ActionInfo& b) {
+            return a.p < b.p;
+        })->p;
+    if (max_p >= cfg.sharp_prior || first.n >= cfg.dominance * game.searched)
+        return;
+    bool close = second.n >= cfg.close_visits * first.n 
+        || (second.n > 0 && std::abs(first.q - second.q) < cfg.close_q);
+    if (game.searched + game.book_visits >= cfg.compute_budget && !close)
+        return;
+    size_t step = std::max<size_t>(cfg.compute_budget / BUDGET_STEPS, 1);
+    game.budget = std::min<int64_t>(game.searched + step, cap);
+}
 
-    Board::State result = board.GetState();
-    out << fmt::format("{}, game len: {}, total {:.1f} sec", 
-        Board::state2str(result), game_len,
-        std::chrono::duration<double>(total_ed - total_st).count())
-         << std::endl;
 
-    std::filesystem::path state_save_path
-        = out_state_dir / fmt::format("{:04d}.bin", game_idx);
-    gomoku::logger::Log selfplay_log(game_len, result, actions, counts);
-    try {
-        selfplay_log.Save(state_save_path);
+bool Server::EndMove(Server::Game& game) {
+    const SelfplayConfig& cfg = config.sp_cfg;
+    std::chrono::system_clock::time_point ed = std::chrono::system_clock::now();
+    int game_len = game.actions.size();
+
+    if (game_len > 0 && game.full && cfg.adaptive_budget) {
+        game.bank -= game.searched;
+        game.full_moves++;
+        game.full_searched += game.searched;
     }
-    catch (std::exception& e) {
-        out << "error saving log to " << state_save_path 
-            << ": " << e.what() << std::endl;
-        return 1;
+
+    std::vector<MCTS::ActionInfo> action_infos = game.tree->GetActionInfos();
+    if (game.book) {
+        // only what this game searched goes back, the rest is already there
+        std::vector<MCTS::ChildStats> searched;
+        for (const MCTS::ActionInfo& info: action_infos) {
+            MCTS::ChildStats child = {info.action, info.n, info.q * info.n};
+            for (const MCTS::ChildStats& seeded: game.book_stats) {
+                if (seeded.action == info.action) {
+                    child.n -= seeded.n;
+                    child.w -= seeded.w;
+                }
+            }
+            if (child.n > 0)
+                searched.push_back(child);
+        }
+        book.Add(game.actions, game.book_generation, searched);
     }
-    return 0;
+    if (cfg.resign_threshold > -1 && game_len > 0 && game.resigner == EMPTY) {
+        const MCTS::ActionInfo& best = *std::max_element(
+            action_infos.begin(), action_infos.end(), 
+            [](const MCTS::ActionInfo& a, const MCTS::ActionInfo& b) {
+                return a.n < b.n;
+            });
+        Color turn = game.board.GetTurn();
+        if (game.tree->GetRootValue() < cfg.resign_threshold 
+            && best.q < cfg.resign_threshold)
+            game.low_moves[turn]++;
+        else
+            game.low_moves[turn] = 0;
+        if (game.low_moves[turn] >= cfg.resign_moves) {
+            game.resigner = turn;
+            game.resign_move = game_len;
+            if (game.can_resign)
+                return false;
+        }
+    }
+    // Action best = tree.GetBestAction();
+    Action move = SelectMove(action_infos, game_len);
+
+    game.board.Play(move);
+    if (config.verbosity >= 3)
+        game.out << game.board << '\n';
+    if (config.verbosity >= 2) {
+        game.out << fmt::format(
+            "action: {:>3}, searches: {}{}, search time: {:.4f} sec{}\n",
+            Coord2String(Action2Coord(move)), game.searched, 
+            game.book_visits 
+                ? fmt::format(" + {} from the book", game.book_visits) : "",
+            std::chrono::duration<double>(ed - game.st).count(),
+            game.full ? "" : " (fast)");
+        ShowTopActions(action_infos, 5, game.out);
+        game.out << '\n';
+    }
+    game.tree->Play(move);
+    game.tree->Reset(game.board, game.expand);
+
+    game.actions.push_back(move);
+    game.full_search.push_back(game.full);
+    game.searches.push_back(game.searched);
+    std::vector<int> single_counts(SIZE * SIZE, 0);
+    for (const MCTS::ActionInfo& info: action_infos) {
+        single_counts[info.action] = info.n;
+    }
+    game.counts.emplace_back(std::move(single_counts));
+    return !game.board.Terminated();
+}
+
+
+void Server::EndGame(Server::Game& game) {
+    std::chrono::system_clock::time_point total_ed 
+        = std::chrono::system_clock::now();
+    int game_len = game.actions.size();
+
+    Board::State result = game.board.GetState();
+    bool resigned = game.can_resign && game.resigner != EMPTY;
+    if (resigned)
+        result = (game.resigner == BLACK) 
+            ? Board::State::WHITE_WIN : Board::State::BLACK_WIN;
+    // a played out game shows whether the resignation would have been right
+    bool false_resign = !resigned && game.resigner != EMPTY 
+        && result != ((game.resigner == BLACK) 
+            ? Board::State::WHITE_WIN : Board::State::BLACK_WIN);
+    if (config.verbosity >= 1) {
+        game.out << fmt::format("{}, game len: {}, total {:.1f} sec\n", 
+            Board::state2str(result), game_len,
+            std::chrono::duration<double>(total_ed - game.total_st).count());
+        if (resigned)
+            game.out << fmt::format("{} resigned at move {}\n", 
+                (game.resigner == BLACK) ? "black" : "white", 
+                game.resign_move);
+        else if (game.resigner != EMPTY)
+            game.out << fmt::format(
+                "played out, {} would have resigned at move {}, {}\n", 
+                (game.resigner == BLACK) ? "black" : "white", 
+                game.resign_move, false_resign ? "wrongly" : "rightly");
+        int end_generation = Generation();
+        if (end_generation == game.start_generation)
+            game.out << fmt::format(
+                "model generation: {}\n", game.start_generation);
+        else
+            game.out << fmt::format("model generation: {} -> {}\n", 
+                game.start_generation, end_generation);
+        writer->WriteText(out_txt_dir / fmt::format("{:04d}.txt", game.idx), 
+            game.out.str());
+    }
+
+    // errors are reported by the writer thread
+    writer->WriteGame(
+        logger::Log(game_len, result, game.actions, game.counts, 
+            game.start_generation, game.full_search, game.searches), 
+        game.idx, out_state_dir / fmt::format("{:04d}.bin", game.idx));
+
+    std::unique_lock<std::mutex> lock(m_master);
+    n_resigned += resigned;
+    n_would_resign += !resigned && game.resigner != EMPTY;
+    n_false_resign += false_resign;
+    n_full_moves += game.full_moves;
+    n_full_searches += game.full_searched;
+    done++;
+    master_pbar->set_option(pb::option::PrefixText(
+        fmt::format("[{:>4}/{:>4}]", done, total)));
+    master_pbar->tick();
 }
 
 
@@ -209,12 +678,37 @@ std::ostream& operator<<(std::ostream& out, const Server::Config& cfg) {
     out << "logging start index: " << cfg.starting_index << "\n";
     out << "max games: " << cfg.max_games << "\n";
     out << "num workers: " << cfg.n_workers << "\n";
+    out << "games per worker: " << cfg.games_per_worker << "\n";
+    out << "num evaluators: " << cfg.n_evaluators << "\n";
+    out << "inference server: " << cfg.shm_name << "\n";
+    out << "reload interval: " << cfg.reload_interval << "\n";
+    out << "shard size (MB): " << cfg.shard_mb << "\n";
+    out << "text trace verbosity: " << cfg.verbosity << "\n";
+    out << "warmup iterations: " << cfg.warmup_iters << "\n";
     out << "mcts config: " << cfg.mcts_cfg << "\n";
+    out << "evaluator config: " << cfg.ev_cfg << "\n";
+    out << "eval queue config: " << cfg.eq_cfg << "\n";
     out << "selfplay compute budget: " << cfg.sp_cfg.compute_budget << "\n";
     out << "selfplay sample steps: " << cfg.sp_cfg.sample_steps << "\n";
     out << "selfplay noise steps: " << cfg.sp_cfg.noise_steps << "\n";
     out << "selfplay noise epsilon: " << cfg.sp_cfg.noise_eps << "\n";
-    out << "selfplay noise alpha: " << cfg.sp_cfg.noise_alpha;
+    out << "selfplay noise alpha: " << cfg.sp_cfg.noise_alpha << "\n";
+    out << "selfplay candidate distance: " << cfg.sp_cfg.candidate_dist << "\n";
+    out << "selfplay resign threshold: " << cfg.sp_cfg.resign_threshold << "\n";
+    out << "selfplay resign moves: " << cfg.sp_cfg.resign_moves << "\n";
+    out << "selfplay resign playout: " << cfg.sp_cfg.resign_playout << "\n";
+    out << "selfplay full search prob: " << cfg.sp_cfg.full_search_prob << "\n";
+    out << "selfplay fast budget: " << cfg.sp_cfg.fast_budget << "\n";
+    out << "selfplay adaptive budget: " << cfg.sp_cfg.adaptive_budget << "\n";
+    out << "selfplay min budget: " << cfg.sp_cfg.min_budget << "\n";
+    out << "selfplay max budget: " << cfg.sp_cfg.max_budget << "\n";
+    out << "selfplay sharp prior: " << cfg.sp_cfg.sharp_prior << "\n";
+    out << "selfplay dominance: " << cfg.sp_cfg.dominance << "\n";
+    out << "selfplay close visits: " << cfg.sp_cfg.close_visits << "\n";
+    out << "selfplay close q: " << cfg.sp_cfg.close_q << "\n";
+    out << "selfplay opening stones: " << cfg.sp_cfg.opening_stones << "\n";
+    out << "selfplay opening top up: " << cfg.sp_cfg.opening_top_up << "\n";
+    out << "selfplay opening visits: " << cfg.sp_cfg.opening_visits;
     return out;
 }
 
@@ -226,8 +720,9 @@ GetSelfplayConfig(Server::Config& cfg) {
         (
             "model_path", 
             boost::program_options::value<std::filesystem::path>
-                (&cfg.model_path)->required(), 
-            "torch jit module path"
+                (&cfg.model_path), 
+            "torch jit module path, or weight file for the native backend, "
+            "required without shm_name"
         )
         (
             "out_dir", 
@@ -251,7 +746,89 @@ GetSelfplayConfig(Server::Config& cfg) {
             "n_workers", 
             boost::program_options::value<size_t>(&cfg.n_workers)
                 ->default_value(1),
-            "number of games played simultaneously"
+            "number of worker threads, each plays one game at a time unless "
+            "games_per_worker is set"
+        )
+        (
+            "games_per_worker", 
+            boost::program_options::value<size_t>(&cfg.games_per_worker)
+                ->default_value(0),
+            "games a worker plays at once, evaluating a leaf of each in one "
+            "batch without mcts search threads, 0 for a game per worker"
+        )
+        (
+            "shm_name", 
+            boost::program_options::value<std::string>(&cfg.shm_name)
+                ->default_value(""),
+            "evaluate on the inference server of this shared memory name "
+            "instead of a model of this process"
+        )
+        (
+            "n_evaluators", 
+            boost::program_options::value<size_t>(&cfg.n_evaluators)
+                ->default_value(1),
+            "number of evaluator replicas, each with its own model copy"
+        )
+        (
+            "replica_threads", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.replica_threads)->multitoken(),
+            "intra-op threads of each evaluator replica, one value for all "
+            "or one per replica"
+        )
+        (
+            "report_batches", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.report_batches)->multitoken(),
+            "batch sizes to report ready-state evaluation latency for, "
+            "defaults to the warmup batch sizes"
+        )
+        (
+            "warmup_iters", 
+            boost::program_options::value<int>(&cfg.warmup_iters)
+                ->default_value(5),
+            "passes over the warmup batch sizes before selfplay starts "
+            "and after a reload, 0 to skip"
+        )
+        (
+            "warmup_batches", 
+            boost::program_options::value<std::vector<int>>
+                (&cfg.warmup_batches)->multitoken(),
+            "batch sizes to warm up on, defaults to powers of two up to "
+            "max_batch"
+        )
+        (
+            "reload_interval", 
+            boost::program_options::value<double>(&cfg.reload_interval)
+                ->default_value(0),
+            "seconds between checks of model_path for a new checkpoint, "
+            "0 to reload only on SIGHUP"
+        )
+        (
+            "shard_mb", 
+            boost::program_options::value<size_t>(&cfg.shard_mb)
+                ->default_value(256),
+            "append games to shards of this many MB under out_dir/shards, "
+            "0 to write a file per game under out_dir/state"
+        )
+        (
+            "shard_sync", 
+            boost::program_options::bool_switch(&cfg.shard_sync),
+            "fsync every game appended to a shard"
+        )
+        (
+            "verbosity", 
+            boost::program_options::value<int>(&cfg.verbosity)
+                ->default_value(3),
+            "text trace of each game under out_dir/txt, 0 for none, "
+            "1 for the result, 2 adds every move with its top actions, "
+            "3 adds the board after every move"
+        )
+        (
+            "write_queue", 
+            boost::program_options::value<size_t>(&cfg.write_queue)
+                ->default_value(64),
+            "outputs queued for the writer thread before games wait on it"
         )
         (
             "n_searches", 
@@ -283,6 +860,109 @@ GetSelfplayConfig(Server::Config& cfg) {
                 ->default_value(0.03),
             "dirichlet alpha for selfplay noise"
         )
+        (
+            "candidate_dist", 
+            boost::program_options::value<int>(&cfg.sp_cfg.candidate_dist)
+                ->default_value(0),
+            "only search moves within this distance of a stone, 0 for all"
+        )
+        (
+            "resign_threshold", 
+            boost::program_options::value<double>(&cfg.sp_cfg.resign_threshold)
+                ->default_value(-1),
+            "resign when the root value and the best move's q fall below "
+            "this, -1 never resigns"
+        )
+        (
+            "resign_moves", 
+            boost::program_options::value<int>(&cfg.sp_cfg.resign_moves)
+                ->default_value(3),
+            "consecutive moves of a side below resign_threshold to resign"
+        )
+        (
+            "resign_playout", 
+            boost::program_options::value<double>(&cfg.sp_cfg.resign_playout)
+                ->default_value(0.1),
+            "fraction of games played out without resigning, to measure the "
+            "false resignation rate"
+        )
+        (
+            "full_search_prob", 
+            boost::program_options::value<double>(&cfg.sp_cfg.full_search_prob)
+                ->default_value(1.0),
+            "probability of a move getting n_searches and a policy target, "
+            "the others get fast_searches and only a value target"
+        )
+        (
+            "fast_searches", 
+            boost::program_options::value<size_t>(&cfg.sp_cfg.fast_budget)
+                ->default_value(100),
+            "number of MCTS searches of a fast move"
+        )
+        (
+            "adaptive_budget", 
+            boost::program_options::bool_switch(&cfg.sp_cfg.adaptive_budget),
+            "spend fewer searches on clear moves and more on close ones, "
+            "at most n_searches per full move over a game"
+        )
+        (
+            "min_budget", 
+            boost::program_options::value<double>(&cfg.sp_cfg.min_budget)
+                ->default_value(0.25),
+            "fraction of n_searches an adaptive move searches at least"
+        )
+        (
+            "max_budget", 
+            boost::program_options::value<double>(&cfg.sp_cfg.max_budget)
+                ->default_value(2.0),
+            "multiple of n_searches an adaptive move searches at most"
+        )
+        (
+            "sharp_prior", 
+            boost::program_options::value<double>(&cfg.sp_cfg.sharp_prior)
+                ->default_value(0.9),
+            "root prior of a move that makes the search stop early"
+        )
+        (
+            "dominance", 
+            boost::program_options::value<double>(&cfg.sp_cfg.dominance)
+                ->default_value(0.7),
+            "share of the visits of the best move that makes the search "
+            "stop early"
+        )
+        (
+            "close_visits", 
+            boost::program_options::value<double>(&cfg.sp_cfg.close_visits)
+                ->default_value(0.8),
+            "visits of the second move relative to the best one to search "
+            "past n_searches"
+        )
+        (
+            "close_q", 
+            boost::program_options::value<double>(&cfg.sp_cfg.close_q)
+                ->default_value(0.02),
+            "q difference of the two best moves to search past n_searches"
+        )
+        (
+            "opening_stones", 
+            boost::program_options::value<int>(&cfg.sp_cfg.opening_stones)
+                ->default_value(0),
+            "pool the root stats of positions with fewer stones over games "
+            "and search them from there, 0 disables the opening book"
+        )
+        (
+            "opening_top_up", 
+            boost::program_options::value<double>(&cfg.sp_cfg.opening_top_up)
+                ->default_value(0.25),
+            "fraction of its budget a move searches at least on top of the "
+            "opening book"
+        )
+        (
+            "opening_visits", 
+            boost::program_options::value<int>(&cfg.sp_cfg.opening_visits)
+                ->default_value(10000),
+            "visits of a book position past which its stats are halved"
+        )
     ;
     return desc;
 }
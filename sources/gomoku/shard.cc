@@ -0,0 +1,360 @@
+#include <array>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fmt/format.h>
+#include "gomoku/shard.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+const static size_t FOOTER = sizeof(uint64_t) + sizeof(uint32_t);
+
+
+template <typename T>
+static void PutRaw(std::string& out, T value) {
+    out.append((const char*)&value, sizeof(T));
+}
+
+
+template <typename T>
+static T GetRaw(const uint8_t* ptr) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+
+std::filesystem::path ShardPath(const std::filesystem::path& dir, int idx) {
+    return dir / fmt::format("shard-{:05d}.bin", idx);
+}
+
+
+// the records of a closed shard from its footer, false if it has none or
+// the footer does not hold together
+static bool ReadFooter(const uint8_t* data, uint64_t size,
+    std::vector<std::pair<int64_t, uint64_t>>& records, uint64_t& end) {
+    const size_t entry = sizeof(int64_t) + sizeof(uint64_t);
+    if (size < sizeof(ShardHeader) + 2 * sizeof(uint32_t) + FOOTER
+        || GetRaw<uint32_t>(data + size - sizeof(uint32_t)) != FOOTER_MAGIC)
+        return false;
+    uint64_t index_offset = GetRaw<uint64_t>(data + size - FOOTER);
+    if (index_offset < sizeof(ShardHeader) 
+        || index_offset + 2 * sizeof(uint32_t) + FOOTER > size
+        || GetRaw<uint32_t>(data + index_offset) != INDEX_MAGIC)
+        return false;
+    uint32_t n = GetRaw<uint32_t>(data + index_offset + sizeof(uint32_t));
+    if (index_offset + 2 * sizeof(uint32_t) + n * entry + FOOTER != size)
+        return false;
+    const uint8_t* ptr = data + index_offset + 2 * sizeof(uint32_t);
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < n; i++, ptr += entry) {
+        int64_t game_idx = GetRaw<int64_t>(ptr);
+        uint64_t offset = GetRaw<uint64_t>(ptr + sizeof(int64_t));
+        if (offset < std::max<uint64_t>(prev, sizeof(ShardHeader))
+            || offset + RECORD_HEADER > index_offset) {
+            records.clear();
+            return false;
+        }
+        records.emplace_back(game_idx, offset);
+        prev = offset + RECORD_HEADER;
+    }
+    end = index_offset;
+    return true;
+}
+
+
+uint64_t ScanRecords(const uint8_t* data, uint64_t size,
+    std::vector<std::pair<int64_t, uint64_t>>& records, uint64_t start) {
+    records.clear();
+    uint64_t end = size;
+    // a closed shard is read from its footer, without touching the records
+    if (ReadFooter(data, size, records, end)) {
+        records.erase(records.begin(), std::lower_bound(
+            records.begin(), records.end(), start,
+            [](const std::pair<int64_t, uint64_t>& record, uint64_t offset) {
+                return record.second < offset;
+            }));
+        return end;
+    }
+    // otherwise the records are scanned up to the first torn one
+    uint64_t pos = start;
+    while (pos + RECORD_HEADER <= end) {
+        const uint8_t* ptr = data + pos;
+        uint32_t payload_size = GetRaw<uint32_t>(ptr + sizeof(uint32_t));
+        if (GetRaw<uint32_t>(ptr) != RECORD_MAGIC
+            || pos + RECORD_HEADER + payload_size > end
+            || GetRaw<uint32_t>(ptr + 2 * sizeof(uint32_t))
+                != Crc32(ptr + RECORD_HEADER, payload_size))
+            break;
+        const uint8_t* payload = ptr + RECORD_HEADER;
+        uint64_t game_idx;
+        GetVarint(payload, payload + payload_size, game_idx);
+        records.emplace_back((int64_t)game_idx, pos);
+        pos += RECORD_HEADER + payload_size;
+    }
+    return pos;
+}
+
+
+void PutVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+
+bool GetVarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && ptr < end; shift += 7) {
+        uint8_t byte = *ptr++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+
+uint32_t Crc32(const uint8_t* data, size_t size) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+
+ShardWriter::ShardWriter(const ShardWriter::Config& conf): config(conf) {
+    if (config.max_bytes == 0)
+        throw std::runtime_error("ShardWriter max_bytes must be positive");
+    std::filesystem::create_directories(config.dir);
+}
+
+
+ShardWriter::~ShardWriter() {
+    try {
+        Close();
+    }
+    catch (const std::exception&) {
+        // records already written are still recovered by the next reader
+    }
+}
+
+
+void ShardWriter::Append(const Log& log, int64_t game_idx) {
+    Append({{&log, game_idx}});
+}
+
+
+void ShardWriter::Append(
+    const std::vector<std::pair<const Log*, int64_t>>& games) {
+    std::vector<std::string> encoded;
+    for (auto [log, game_idx]: games) {
+        encoded.push_back(Encode(*log, game_idx));
+    }
+
+    std::unique_lock<std::mutex> lock(m);
+    std::string records;
+    for (int i = 0; i < games.size(); i++) {
+        if (fd < 0)
+            Open();
+        index.emplace_back(games[i].second, offset + records.size());
+        records += encoded[i];
+        if (offset + records.size() >= config.max_bytes) {
+            Flush(records);
+            lock.unlock();
+            Close();
+            lock.lock();
+        }
+    }
+    if (!records.empty())
+        Flush(records);
+}
+
+
+std::string ShardWriter::Encode(const Log& log, int64_t game_idx) {
+    std::string payload;
+    PutVarint(payload, game_idx);
+    PutVarint(payload, log.Generation());
+    PutVarint(payload, log.Result());
+    PutVarint(payload, log.Length());
+    std::string pairs;
+    for (int i = 0; i < log.Length(); i++) {
+        PutVarint(payload, log.Actions()[i]);
+        PutVarint(payload, log.FullSearch(i));
+        PutVarint(payload, log.Searches(i));
+        const int32_t* counts = log.Counts(i);
+        pairs.clear();
+        int n = 0, prev = -1;
+        for (int action = 0; action < SIZE * SIZE; action++) {
+            if (counts[action] <= 0)
+                continue;
+            PutVarint(pairs, action - prev - 1);
+            PutVarint(pairs, counts[action]);
+            prev = action;
+            n++;
+        }
+        PutVarint(payload, n);
+        payload += pairs;
+    }
+
+    std::string record;
+    record.reserve(RECORD_HEADER + payload.size());
+    PutRaw<uint32_t>(record, RECORD_MAGIC);
+    PutRaw<uint32_t>(record, payload.size());
+    PutRaw<uint32_t>(record,
+        Crc32((const uint8_t*)payload.data(), payload.size()));
+    record += payload;
+    return record;
+}
+
+
+void ShardWriter::Flush(std::string& records) {
+    try {
+        Write(records);
+    }
+    catch (const std::exception&) {
+        // a partial record would hide every later one from readers
+        ::ftruncate(fd, offset);
+        ::lseek(fd, offset, SEEK_SET);
+        while (!index.empty() && index.back().second >= offset) {
+            index.pop_back();
+        }
+        throw;
+    }
+    if (config.sync)
+        ::fsync(fd);
+    offset += records.size();
+    records.clear();
+}
+
+
+void ShardWriter::Close() {
+    std::unique_lock<std::mutex> lock(m);
+    if (fd < 0)
+        return;
+    std::string footer;
+    PutRaw<uint32_t>(footer, INDEX_MAGIC);
+    PutRaw<uint32_t>(footer, index.size());
+    for (auto [game_idx, record_offset]: index) {
+        PutRaw<int64_t>(footer, game_idx);
+        PutRaw<uint64_t>(footer, record_offset);
+    }
+    PutRaw<uint64_t>(footer, offset);
+    PutRaw<uint32_t>(footer, FOOTER_MAGIC);
+    Write(footer);
+    ::fsync(fd);
+    ::close(fd);
+    fd = -1;
+    index.clear();
+    shard_idx++;
+}
+
+
+void ShardWriter::Open() {
+    // shards locked by another writer, already full or of an older version
+    // are skipped, so several selfplay processes can share one directory
+    for (;; shard_idx++) {
+        path = ShardPath(config.dir, shard_idx);
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error(fmt::format(
+                "shard {}: cannot open: {}", path.string(), strerror(errno)));
+        struct stat st;
+        ShardHeader shard_header;
+        if (::flock(fd, LOCK_EX | LOCK_NB) == 0 && ::fstat(fd, &st) == 0
+            && st.st_size < config.max_bytes
+            && (st.st_size < (off_t)sizeof(ShardHeader)
+                || (::pread(fd, &shard_header, sizeof(shard_header), 0)
+                        == sizeof(shard_header)
+                    && shard_header.version == ShardHeader::VERSION)))
+            break;
+        ::close(fd);
+    }
+    try {
+        Recover(path);
+    }
+    catch (const std::exception&) {
+        ::close(fd);
+        fd = -1;
+        throw;
+    }
+}
+
+
+void ShardWriter::Recover(const std::filesystem::path& path) {
+    struct stat st;
+    ::fstat(fd, &st);
+    std::vector<uint8_t> data(st.st_size);
+    if (::pread(fd, data.data(), data.size(), 0) != (ssize_t)data.size())
+        throw std::runtime_error(fmt::format(
+            "shard {}: cannot read: {}", path.string(), strerror(errno)));
+
+    index.clear();
+    if (data.size() < sizeof(ShardHeader)) {
+        // new, or a crash before the header was complete
+        ::ftruncate(fd, 0);
+        ShardHeader shard_header;
+        std::string header((const char*)&shard_header, sizeof(shard_header));
+        ::lseek(fd, 0, SEEK_SET);
+        Write(header);
+        offset = header.size();
+        return;
+    }
+    ShardHeader shard_header = GetRaw<ShardHeader>(data.data());
+    if (shard_header.magic != ShardHeader::MAGIC
+        || shard_header.version != ShardHeader::VERSION
+        || shard_header.size != SIZE)
+        throw std::runtime_error(fmt::format(
+            "shard {}: not a version {} shard of size {}",
+            path.string(), ShardHeader::VERSION, SIZE));
+
+    // the footer is dropped and written again on close
+    uint64_t pos = ScanRecords(data.data(), data.size(), index);
+    if (::ftruncate(fd, pos) != 0)
+        throw std::runtime_error(fmt::format(
+            "shard {}: cannot truncate: {}", path.string(), strerror(errno)));
+    ::lseek(fd, pos, SEEK_SET);
+    offset = pos;
+}
+
+
+void ShardWriter::Write(const std::string& data) {
+    const char* ptr = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, ptr, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(fmt::format(
+                "shard {}: cannot write: {}", path.string(), strerror(errno)));
+        ptr += n;
+        left -= n;
+    }
+}
+
+
+}
+}
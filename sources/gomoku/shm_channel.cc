@@ -0,0 +1,325 @@
+#include <bit>
+#include <new>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fmt/format.h>
+#include "gomoku/shm_channel.h"
+
+
+
+namespace gomoku {
+
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free
+              && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), 
+              "futex words have to be plain 32 bit integers");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, 
+              "ring positions are shared between processes");
+
+
+static std::string ShmName(const std::string& name) {
+    return (!name.empty() && name.front() == '/') ? name : "/" + name;
+}
+
+
+ShmChannel::ShmChannel(const std::string& name_, uint32_t n_slots_)
+: name(ShmName(name_)), owner(true) {
+    if (n_slots_ == 0)
+        throw std::runtime_error("ShmChannel needs at least one slot");
+    n_slots = std::bit_ceil(n_slots_);
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "cannot create shared memory {}: {}", name, std::strerror(errno)));
+    }
+    size_t total = Size(n_slots);
+    if (ftruncate(fd, total) != 0) {
+        int err = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error(fmt::format(
+            "cannot size shared memory {}: {}", name, std::strerror(err)));
+    }
+    Map(fd, total);
+
+    Header* header = new (base) Header();
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->n_slots = n_slots;
+    header->slot_size = sizeof(Slot);
+    header->server_pid = getpid();
+    header->generation.store(0);
+    header->pending.store(0);
+    for (int ring = FREE_RING; ring <= REQUEST_RING; ring++) {
+        Ring* r = new (&GetRing(ring)) Ring();
+        r->head.store(0);
+        r->tail.store(0);
+        Cell* cells = GetCells(ring);
+        for (uint32_t i = 0; i < n_slots; i++) {
+            new (&cells[i]) Cell();
+            cells[i].seq.store(i);
+        }
+    }
+    for (uint32_t i = 0; i < n_slots; i++) {
+        new (&GetSlot(i)) Slot();
+        GetSlot(i).state.store(IDLE);
+        GetSlot(i).owner.store(0);
+        TryPush(FREE_RING, i);
+    }
+    header->alive.store(1, std::memory_order_release);
+}
+
+
+ShmChannel::ShmChannel(const std::string& name_)
+: name(ShmName(name_)), owner(false) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "cannot open shared memory {}, is the inference server running? "
+            "{}", name, std::strerror(errno)));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error(
+            fmt::format("shared memory {} is not initialized", name));
+    }
+    Map(fd, st.st_size);
+
+    const Header& header = GetHeader();
+    std::string error;
+    if (header.magic != MAGIC || header.version != VERSION
+        || header.slot_size != sizeof(Slot))
+        error = fmt::format("shared memory {} has version {}, expected {}", 
+            name, header.version, VERSION);
+    else if (Size(header.n_slots) > size)
+        error = fmt::format("shared memory {} is truncated", name);
+    else if (!ServerAlive())
+        error = fmt::format("inference server of {} has stopped", name);
+    if (!error.empty()) {
+        munmap(base, size);
+        throw std::runtime_error(error);
+    }
+    n_slots = header.n_slots;
+}
+
+
+ShmChannel::~ShmChannel() {
+    if (base) {
+        if (owner) {
+            GetHeader().alive.store(0, std::memory_order_release);
+            Wake(GetHeader().pending, INT32_MAX);
+            for (uint32_t i = 0; i < n_slots; i++) {
+                Wake(GetSlot(i).state, INT32_MAX);
+            }
+        }
+        munmap(base, size);
+    }
+    if (owner)
+        shm_unlink(name.c_str());
+}
+
+
+size_t ShmChannel::Size(uint32_t n_slots) {
+    size_t header = (sizeof(Header) + 63) / 64 * 64;
+    size_t ring = sizeof(Ring) + sizeof(Cell) * n_slots;
+    return header + 2 * ring + sizeof(Slot) * n_slots;
+}
+
+
+void ShmChannel::Map(int fd, size_t size_) {
+    void* ptr = mmap(
+        nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        if (owner)
+            shm_unlink(name.c_str());
+        throw std::runtime_error(fmt::format(
+            "cannot map shared memory {}: {}", name, std::strerror(err)));
+    }
+    base = static_cast<uint8_t*>(ptr);
+    size = size_;
+}
+
+
+ShmChannel::Header& ShmChannel::GetHeader() const {
+    return *reinterpret_cast<Header*>(base);
+}
+
+
+bool ShmChannel::ServerAlive() const {
+    const Header& header = GetHeader();
+    if (!header.alive.load(std::memory_order_acquire))
+        return false;
+    return kill(header.server_pid, 0) == 0 || errno == EPERM;
+}
+
+
+ShmChannel::Ring& ShmChannel::GetRing(int ring) const {
+    size_t offset = (sizeof(Header) + 63) / 64 * 64
+        + ring * (sizeof(Ring) + sizeof(Cell) * n_slots);
+    return *reinterpret_cast<Ring*>(base + offset);
+}
+
+
+ShmChannel::Cell* ShmChannel::GetCells(int ring) const {
+    return reinterpret_cast<Cell*>(
+        reinterpret_cast<uint8_t*>(&GetRing(ring)) + sizeof(Ring));
+}
+
+
+ShmChannel::Slot& ShmChannel::GetSlot(uint32_t idx) const {
+    size_t offset = (sizeof(Header) + 63) / 64 * 64
+        + 2 * (sizeof(Ring) + sizeof(Cell) * n_slots);
+    return reinterpret_cast<Slot*>(base + offset)[idx];
+}
+
+
+bool ShmChannel::TryAcquire(uint32_t& idx) {
+    if (!TryPop(FREE_RING, idx))
+        return false;
+    GetSlot(idx).owner.store(getpid(), std::memory_order_relaxed);
+    return true;
+}
+
+
+void ShmChannel::Release(uint32_t idx) {
+    Slot& slot = GetSlot(idx);
+    slot.state.store(IDLE, std::memory_order_relaxed);
+    slot.owner.store(0, std::memory_order_relaxed);
+    // there are as many cells as slots, so this never fails
+    TryPush(FREE_RING, idx);
+}
+
+
+void ShmChannel::Submit(uint32_t idx, uint32_t priority) {
+    Slot& slot = GetSlot(idx);
+    slot.priority = priority;
+    slot.enqueued = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    slot.state.store(SUBMITTED, std::memory_order_relaxed);
+    TryPush(REQUEST_RING, idx);
+    // the server only sleeps while nothing is pending
+    Header& header = GetHeader();
+    if (header.pending.fetch_add(1, std::memory_order_release) == 0)
+        Wake(header.pending, 1);
+}
+
+
+bool ShmChannel::TryTake(uint32_t& idx) {
+    return TryPop(REQUEST_RING, idx);
+}
+
+
+void ShmChannel::Complete(uint32_t idx) {
+    Slot& slot = GetSlot(idx);
+    slot.state.store(DONE, std::memory_order_release);
+    Wake(slot.state, 1);
+}
+
+
+int ShmChannel::Reclaim() {
+    int n_reclaimed = 0;
+    for (uint32_t i = 0; i < n_slots; i++) {
+        Slot& slot = GetSlot(i);
+        int32_t owner_pid = slot.owner.load(std::memory_order_acquire);
+        if (owner_pid == 0 || slot.state.load() == SUBMITTED)
+            continue;
+        if (kill(owner_pid, 0) == 0 || errno != ESRCH)
+            continue;
+        // the owner is gone, so nobody else releases the slot
+        if (!slot.owner.compare_exchange_strong(owner_pid, 0))
+            continue;
+        slot.state.store(IDLE, std::memory_order_relaxed);
+        TryPush(FREE_RING, i);
+        n_reclaimed++;
+    }
+    return n_reclaimed;
+}
+
+
+bool ShmChannel::TryPush(int ring, uint32_t idx) {
+    Ring& r = GetRing(ring);
+    Cell* cells = GetCells(ring);
+    uint64_t mask = n_slots - 1;
+    uint64_t pos = r.head.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        uint64_t seq = cell.seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0) {
+            if (r.head.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                cell.idx = idx;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = r.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+
+bool ShmChannel::TryPop(int ring, uint32_t& idx) {
+    Ring& r = GetRing(ring);
+    Cell* cells = GetCells(ring);
+    uint64_t mask = n_slots - 1;
+    uint64_t pos = r.tail.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        uint64_t seq = cell.seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+        if (diff == 0) {
+            if (r.tail.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                idx = cell.idx;
+                cell.seq.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = r.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+
+void ShmChannel::Wait(
+    std::atomic<uint32_t>& word, uint32_t old, int64_t timeout_us) {
+    // not the private futex of std::atomic::wait, the word is shared
+    // between processes
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), 
+            FUTEX_WAIT, old, &timeout, nullptr, 0);
+}
+
+
+void ShmChannel::Wake(std::atomic<uint32_t>& word, int n) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), 
+            FUTEX_WAKE, n, nullptr, nullptr, 0);
+}
+
+
+}
@@ -0,0 +1,165 @@
+#include <thread>
+#include <deque>
+#include <random>
+#include <stdexcept>
+#include <fmt/format.h>
+#include "gomoku/shm_evaluator.h"
+
+
+
+namespace gomoku {
+
+
+thread_local std::mt19937 shm_gen(std::random_device{}());
+
+
+ShmEvaluator::ShmEvaluator(const std::string& name)
+: ShmEvaluator::ShmEvaluator(name, EvaluationQueue::Symmetry::NONE) {}
+
+
+ShmEvaluator::ShmEvaluator(
+    const std::string& name, EvaluationQueue::Symmetry symmetry_)
+: symmetry(symmetry_), channel(name) {}
+
+
+Evaluation ShmEvaluator::Evaluate(
+    const mcts::StateBase* state, const mcts::EvalHint& hint) {
+    const Board& board = dynamic_cast<const Board&>(*state);
+    uint32_t priority = EvaluationQueue::Priority(hint);
+    if (symmetry == EvaluationQueue::Symmetry::ENSEMBLE) {
+        // the transforms are submitted as a batch, which never waits for a
+        // slot while holding others, so that callers short of slots cannot
+        // all hold part of their transforms
+        return EvaluateBatch({state}, {hint}).front();
+    }
+
+    int sym = 0;
+    if (symmetry == EvaluationQueue::Symmetry::RANDOM) {
+        sym = std::uniform_int_distribution<int>(0, N_SYMMETRIES - 1)(shm_gen);
+    }
+    uint32_t idx = Submit(GomokuEvaluator::Preprocess(board, sym), priority);
+    return GomokuEvaluator::Postprocess(Receive(idx), board, sym);
+}
+
+
+std::vector<Evaluation> ShmEvaluator::EvaluateBatch(
+    const std::vector<const mcts::StateBase*>& states, 
+    const std::vector<mcts::EvalHint>& hints) {
+    std::vector<const Board*> boards;
+    std::vector<std::vector<int>> syms(states.size());
+    std::vector<Input> inputs;
+    std::vector<uint32_t> priorities;
+    for (size_t i = 0; i < states.size(); i++) {
+        boards.push_back(&dynamic_cast<const Board&>(*states[i]));
+        if (symmetry == EvaluationQueue::Symmetry::ENSEMBLE) {
+            for (int sym = 0; sym < N_SYMMETRIES; sym++) {
+                syms[i].push_back(sym);
+            }
+        }
+        else if (symmetry == EvaluationQueue::Symmetry::RANDOM) {
+            syms[i].push_back(std::uniform_int_distribution<int>(
+                0, N_SYMMETRIES - 1)(shm_gen));
+        }
+        else {
+            syms[i].push_back(0);
+        }
+        for (int sym: syms[i]) {
+            inputs.push_back(GomokuEvaluator::Preprocess(*boards[i], sym));
+            priorities.push_back(EvaluationQueue::Priority(hints[i]));
+        }
+    }
+
+    // a batch larger than the channel would otherwise hold every slot
+    // while waiting for more
+    std::vector<Output> outputs(inputs.size());
+    std::deque<std::pair<size_t, uint32_t>> in_flight;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        uint32_t idx;
+        while (!TrySubmit(inputs[i], priorities[i], idx)) {
+            if (!in_flight.empty()) {
+                auto [j, slot] = in_flight.front();
+                in_flight.pop_front();
+                outputs[j] = Receive(slot);
+                continue;
+            }
+            if (!channel.ServerAlive())
+                throw std::runtime_error(fmt::format(
+                    "inference server of {} has stopped", channel.name));
+            std::this_thread::yield();
+        }
+        in_flight.emplace_back(i, idx);
+    }
+    for (auto [j, slot]: in_flight) {
+        outputs[j] = Receive(slot);
+    }
+
+    std::vector<Evaluation> ret;
+    size_t offset = 0;
+    for (size_t i = 0; i < states.size(); i++) {
+        if (syms[i].size() == 1) {
+            ret.push_back(GomokuEvaluator::Postprocess(
+                std::move(outputs[offset++]), *boards[i], syms[i][0]));
+            continue;
+        }
+        std::vector<Output> state_outputs(
+            std::make_move_iterator(outputs.begin() + offset), 
+            std::make_move_iterator(
+                outputs.begin() + offset + syms[i].size()));
+        offset += syms[i].size();
+        ret.push_back(GomokuEvaluator::Postprocess(
+            std::move(state_outputs), *boards[i], syms[i]));
+    }
+    return ret;
+}
+
+
+int ShmEvaluator::Generation() const {
+    return channel.GetHeader().generation.load(std::memory_order_relaxed);
+}
+
+
+uint32_t ShmEvaluator::Submit(const Input& input, uint32_t priority) {
+    uint32_t idx;
+    // every slot in use means the server is behind, not gone, slots of
+    // stopped clients are reclaimed by the server
+    while (!TrySubmit(input, priority, idx)) {
+        if (!channel.ServerAlive())
+            throw std::runtime_error(fmt::format(
+                "inference server of {} has stopped", channel.name));
+        std::this_thread::yield();
+    }
+    return idx;
+}
+
+
+bool ShmEvaluator::TrySubmit(
+    const Input& input, uint32_t priority, uint32_t& idx) {
+    if (!channel.TryAcquire(idx))
+        return false;
+    channel.GetSlot(idx).input = input;
+    channel.Submit(idx, priority);
+    return true;
+}
+
+
+Output ShmEvaluator::Receive(uint32_t idx) {
+    ShmChannel::Slot& slot = channel.GetSlot(idx);
+    while (slot.state.load(std::memory_order_acquire) != ShmChannel::DONE) {
+        ShmChannel::Wait(slot.state, ShmChannel::SUBMITTED, 100000);
+        if (slot.state.load(std::memory_order_acquire) != ShmChannel::DONE
+            && !channel.ServerAlive())
+            throw std::runtime_error(fmt::format(
+                "inference server of {} has stopped", channel.name));
+    }
+    Policy policy;
+    policy.reserve(slot.n_policy);
+    for (int i = 0; i < slot.n_policy; i++) {
+        policy.emplace_back((Action)slot.actions[i], (Prob)slot.probs[i]);
+    }
+    Output output(slot.value, std::move(policy));
+    channel.Release(idx);
+    return output;
+}
+
+
+}
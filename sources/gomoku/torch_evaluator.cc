@@ -0,0 +1,130 @@
+
+#include <mutex>
+#include <torch/torch.h>
+#include "gomoku/torch_evaluator.h"
+
+
+namespace gomoku {
+
+
+TorchEvaluator::TorchEvaluator(torch::jit::script::Module&& model_)
+: TorchEvaluator::TorchEvaluator(std::move(model_), Config()) {}
+
+
+TorchEvaluator::TorchEvaluator
+(torch::jit::script::Module&& model_, GomokuEvaluator::Config conf)
+: GomokuEvaluator(conf), model(std::move(model_)), device(torch::kCPU) {
+    if (torch::cuda::is_available()) {
+        device = torch::Device(torch::kCUDA);
+    }
+    Prepare();
+}
+
+
+TorchEvaluator::TorchEvaluator
+(torch::jit::script::Module&& model_, torch::Device device_)
+: TorchEvaluator::TorchEvaluator(std::move(model_), device_, Config()) {}
+
+
+TorchEvaluator::TorchEvaluator
+(torch::jit::script::Module&& model_, torch::Device device_, 
+ GomokuEvaluator::Config conf)
+: GomokuEvaluator(conf), model(std::move(model_)), device(device_) {
+    Prepare();
+}
+
+
+void TorchEvaluator::Prepare() {
+    // inter-op pool is process wide and can only be sized once
+    static std::once_flag interop_flag;
+    if (config.inter_threads > 0) {
+        std::call_once(interop_flag, [&] {
+            at::set_num_interop_threads(config.inter_threads);
+        });
+    }
+    if (config.precision == Precision::INT8) {
+        // libtorch has no dynamic quantization pass, the module is expected
+        // to be quantized with quantize_dynamic before being scripted
+        at::globalContext().setQEngine(at::QEngine::FBGEMM);
+    }
+
+    model.eval();
+    if (config.precision == Precision::BF16)
+        model.to(device, torch::kBFloat16);
+    else
+        model.to(device);
+
+    if (config.optimize) {
+        model = torch::jit::freeze(model);
+        model = torch::jit::optimize_for_inference(model);
+    }
+}
+
+
+void TorchEvaluator::Save(const std::string& path) const {
+    model.save(path);
+}
+
+
+void TorchEvaluator::BindThread() const {
+    // with the OpenMP backend this only sizes the pool of the calling
+    // thread, so each evaluator thread gets its own share of the cores
+    if (config.intra_threads > 0) {
+        at::set_num_threads(config.intra_threads);
+    }
+}
+
+
+void TorchEvaluator::Forward(Batch& batch) {
+    torch::InferenceMode guard;
+    int size = batch.size;
+
+    torch::Tensor input_tensor = torch::from_blob(
+        batch.states.data(), {size, Input::PLANES, SIZE, SIZE}, 
+        torch::TensorOptions().dtype(torch::kFloat32)).to(device);
+    torch::Tensor turn_tensor = torch::from_blob(
+        batch.turns.data(), {size}, 
+        torch::TensorOptions().dtype(torch::kInt64)).to(device);
+    torch::Tensor mask_tensor = torch::from_blob(
+        batch.masks.data(), {size, SIZE * SIZE}, 
+        torch::TensorOptions().dtype(torch::kUInt8)).to(device, torch::kBool);
+    if (config.precision == Precision::BF16)
+        input_tensor = input_tensor.to(torch::kBFloat16);
+
+    std::vector<torch::jit::IValue> inputs;
+    inputs.push_back(std::move(input_tensor));
+    inputs.push_back(std::move(turn_tensor));
+
+    torch::jit::IValue out = model.forward(inputs);
+    torch::Tensor probs = out.toTuple()->elements()[0].toTensor();
+    torch::Tensor results = out.toTuple()->elements()[1].toTensor();
+
+    probs = torch::masked_fill(probs.to(torch::kFloat32), mask_tensor, -1e+9);
+    probs = torch::nn::functional::softmax(probs, 1);
+    results = results.to(torch::kCPU, torch::kFloat32).contiguous();
+    batch.values.assign(
+        results.data_ptr<float>(), results.data_ptr<float>() + size);
+
+    if (!SparsePolicy()) {
+        probs = probs.to(torch::kCPU).contiguous();
+        batch.k = SIZE * SIZE;
+        batch.probs.assign(probs.data_ptr<float>(), 
+            probs.data_ptr<float>() + size * batch.k);
+        return;
+    }
+
+    // only the top k columns, sorted by probability, leave the device
+    batch.k = (config.policy_topk > 0) 
+        ? std::min(config.policy_topk, SIZE * SIZE) : SIZE * SIZE;
+    auto [top_probs, top_actions] = probs.topk(batch.k, 1);
+    top_probs = top_probs.to(torch::kCPU).contiguous();
+    top_actions = top_actions.to(torch::kCPU).contiguous();
+    batch.probs.assign(top_probs.data_ptr<float>(), 
+        top_probs.data_ptr<float>() + size * batch.k);
+    batch.actions.assign(top_actions.data_ptr<int64_t>(), 
+        top_actions.data_ptr<int64_t>() + size * batch.k);
+}
+
+
+}
+
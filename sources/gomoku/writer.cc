@@ -0,0 +1,131 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <fmt/format.h>
+#include "gomoku/writer.h"
+
+
+namespace gomoku {
+namespace logger {
+
+
+AsyncWriter::AsyncWriter(
+    const AsyncWriter::Config& conf, std::unique_ptr<ShardWriter> shards_)
+: config(conf), shards(std::move(shards_)) {
+    if (config.max_pending == 0)
+        throw std::runtime_error("AsyncWriter max_pending must be positive");
+    writer = std::thread(&AsyncWriter::WriteThread, this);
+}
+
+
+AsyncWriter::~AsyncWriter() {
+    Close();
+}
+
+
+void AsyncWriter::WriteText(std::filesystem::path path, std::string text) {
+    Job job;
+    job.path = std::move(path);
+    job.text = std::move(text);
+    Push(std::move(job));
+}
+
+
+void AsyncWriter::WriteGame(
+    Log&& log, int64_t game_idx, std::filesystem::path path) {
+    Job job;
+    job.path = std::move(path);
+    job.is_game = true;
+    job.log = std::move(log);
+    job.game_idx = game_idx;
+    Push(std::move(job));
+}
+
+
+void AsyncWriter::Close() {
+    {
+        std::unique_lock<std::mutex> lock(m);
+        if (closing)
+            return;
+        closing = true;
+    }
+    cv_pending.notify_all();
+    writer.join();
+    if (shards)
+        shards->Close();
+}
+
+
+void AsyncWriter::Push(AsyncWriter::Job&& job) {
+    std::unique_lock<std::mutex> lock(m);
+    cv_space.wait(lock, [this] {
+        return pending.size() < config.max_pending || closing;
+    });
+    if (closing)
+        throw std::runtime_error("AsyncWriter is closed");
+    pending.push_back(std::move(job));
+    lock.unlock();
+    cv_pending.notify_one();
+}
+
+
+void AsyncWriter::WriteThread() {
+    std::vector<Job> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv_pending.wait(lock, [this] {
+                return !pending.empty() || closing;
+            });
+            if (pending.empty())
+                break;
+            // everything queued so far is written together
+            batch.clear();
+            for (Job& job: pending) {
+                batch.push_back(std::move(job));
+            }
+            pending.clear();
+        }
+        cv_space.notify_all();
+        WriteBatch(batch);
+    }
+}
+
+
+void AsyncWriter::WriteBatch(std::vector<AsyncWriter::Job>& batch) {
+    std::vector<std::pair<const Log*, int64_t>> games;
+    for (Job& job: batch) {
+        if (!job.is_game) {
+            std::ofstream out(job.path, std::ios::out | std::ios::binary);
+            out.write(job.text.data(), job.text.size());
+            if (!out)
+                std::cerr << fmt::format("cannot write {}",
+                    job.path.string()) << std::endl;
+        }
+        else if (shards) {
+            games.emplace_back(&job.log, job.game_idx);
+        }
+        else {
+            try {
+                job.log.Save(job.path);
+            }
+            catch (const std::exception& e) {
+                std::cerr << fmt::format("error saving log to {}: {}",
+                    job.path.string(), e.what()) << std::endl;
+            }
+        }
+    }
+    if (games.empty())
+        return;
+    try {
+        shards->Append(games);
+    }
+    catch (const std::exception& e) {
+        std::cerr << fmt::format("error appending {} games to {}: {}",
+            games.size(), shards->config.dir.string(), e.what()) << std::endl;
+    }
+}
+
+
+}
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <boost/program_options.hpp>
+#include "gomoku/inference_server.h"
+
+
+namespace po = boost::program_options;
+
+
+
+
+int main(int argc, char *argv[]) {
+    
+    gomoku::InferenceServer::Config config;
+    po::options_description gen_cfg("generic config");
+    gen_cfg.add_options()
+        ("help,h", "usage")
+    ;
+    po::options_description ev_cfg = 
+        gomoku::GetEvaluatorConfig(config.ld_cfg.ev_cfg);
+    po::options_description server_cfg = 
+        gomoku::GetInferenceServerConfig(config);
+    po::options_description options;
+    options.add(ev_cfg).add(server_cfg);
+
+    
+    po::variables_map vm;
+    po::parsed_options parsed = po::command_line_parser(argc, argv)
+        .options(gen_cfg)
+        .allow_unregistered()
+        .run();
+    try {
+        po::store(parsed, vm);
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << gen_cfg << std::endl;
+        std::cout << ev_cfg << std::endl;
+        std::cout << server_cfg << std::endl;
+        return 0;
+    }
+
+    
+    std::vector<std::string> unrec
+        = po::collect_unrecognized(parsed.options, po::include_positional);
+    try {
+        parsed = po::command_line_parser(unrec).options(options).run();
+        po::store(parsed, vm);
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "===== Inference Server Settings =====\n";
+    std::cout << config << "\n";
+    std::cout << "=====================================" << std::endl;
+
+    std::cout << std::endl;
+
+    // the shared memory segment is removed on a clean stop
+    std::signal(SIGINT, [](int) {
+        gomoku::InferenceServer::RequestStop();
+    });
+    std::signal(SIGTERM, [](int) {
+        gomoku::InferenceServer::RequestStop();
+    });
+    // kill -HUP reloads the checkpoint at model_path for all clients
+    std::signal(SIGHUP, [](int) {
+        gomoku::InferenceServer::RequestReload();
+    });
+
+    gomoku::InferenceServer server(config);
+    try {
+        server.Run();
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+}
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include <fmt/format.h>
+#include "gomoku/reader.h"
+
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+using gomoku::logger::LogReader;
+
+
+const char* RESULTS[] = {"ongoing", "black win", "white win", "draw"};
+
+
+void ShowStats(const LogReader& reader) {
+    size_t results[4] = {};
+    size_t n_full = 0, n_searched = 0;
+    int64_t full_searches = 0;
+    int min_searches = INT32_MAX, max_searches = 0;
+    int min_generation = INT32_MAX, max_generation = INT32_MIN;
+    for (size_t i = 0; i < reader.NumGames(); i++) {
+        LogReader::Game game = reader.GetGame(i);
+        results[std::clamp(game.result, 0, 3)]++;
+        min_generation = std::min(min_generation, game.generation);
+        max_generation = std::max(max_generation, game.generation);
+        for (int move = 0; move < game.length; move++) {
+            if (!reader.FullSearch(i, move))
+                continue;
+            n_full++;
+            // the opening move is played without a search
+            if (move == 0)
+                continue;
+            int searches = reader.Searches(i, move);
+            n_searched++;
+            full_searches += searches;
+            min_searches = std::min(min_searches, searches);
+            max_searches = std::max(max_searches, searches);
+        }
+    }
+    std::cout << fmt::format("files: {}, games: {}, positions: {}",
+        reader.NumFiles(), reader.NumGames(), reader.NumPositions()) << "\n";
+    if (reader.NumGames() == 0)
+        return;
+    std::cout << fmt::format("average length: {:.1f}, generations {} - {}",
+        (double)reader.NumPositions() / reader.NumGames(),
+        min_generation, max_generation) << "\n";
+    std::cout << fmt::format("fully searched positions: {} ({:.1f}%)",
+        n_full, 100.0 * n_full / reader.NumPositions()) << "\n";
+    if (n_searched > 0)
+        std::cout << fmt::format(
+            "searches per full move: {:.1f} average, {} - {}", 
+            (double)full_searches / n_searched, min_searches, max_searches) 
+            << "\n";
+    for (int r = 0; r < 4; r++) {
+        std::cout << fmt::format("{:>10}: {:>8} ({:.1f}%)", RESULTS[r],
+            results[r], 100.0 * results[r] / reader.NumGames()) << "\n";
+    }
+}
+
+
+void ShowPosition(const LogReader& reader, size_t game_i, int move, int k) {
+    LogReader::Game game = reader.GetGame(game_i);
+    gomoku::Board board = reader.Replay(game_i, move);
+    std::vector<std::pair<mcts::Action, int>> visits;
+    for (auto visit: reader.GetVisits(game_i, move)) {
+        visits.push_back(visit);
+    }
+    std::stable_sort(visits.begin(), visits.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+    int total = 0;
+    for (auto [action, n]: visits) {
+        total += n;
+    }
+
+    std::cout << fmt::format("game {} ({}), move {} of {}, generation {}, {}",
+        game_i, game.game_idx, move, game.length, game.generation,
+        RESULTS[std::clamp(game.result, 0, 3)]) << "\n";
+    std::cout << board << "\n";
+    std::cout << fmt::format("played: {}, searches: {}, visits: {}{}",
+        gomoku::Coord2String(gomoku::Action2Coord(
+            reader.GetAction(game_i, move))), 
+        reader.Searches(game_i, move), total,
+        reader.FullSearch(game_i, move) ? "" : " (fast search)") << "\n";
+    for (int i = 0; i < visits.size() && i < k; i++) {
+        std::cout << fmt::format("{:<4}: N={:>5} ({:.3f})",
+            gomoku::Coord2String(gomoku::Action2Coord(visits[i].first)),
+            visits[i].second, (double)visits[i].second / total) << "\n";
+    }
+    std::cout << std::endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::vector<fs::path> inputs;
+    bool no_index = false;
+    int64_t game = -1;
+    int move;
+    size_t n_samples;
+    int top_k;
+    unsigned seed;
+
+    po::options_description desc("log reader config");
+    desc.add_options()
+        ("help,h", "usage")
+        (
+            "input",
+            po::value<std::vector<fs::path>>(&inputs)->multitoken()
+                ->required(),
+            "game logs or shards, directories are searched for .bin files"
+        )
+        (
+            "no_save_index",
+            po::bool_switch(&no_index),
+            "build missing indices in memory instead of saving them as .idx"
+        )
+        (
+            "game",
+            po::value<int64_t>(&game),
+            "show a game by its position in the inputs"
+        )
+        (
+            "move",
+            po::value<int>(&move)->default_value(-1),
+            "only show this move of the game"
+        )
+        (
+            "sample",
+            po::value<size_t>(&n_samples)->default_value(0),
+            "show this many uniformly sampled positions"
+        )
+        (
+            "top_k",
+            po::value<int>(&top_k)->default_value(5),
+            "most visited actions shown per position"
+        )
+        (
+            "seed",
+            po::value<unsigned>(&seed)->default_value(std::random_device{}()),
+            "seed for sampling positions"
+        )
+    ;
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+            .options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    try {
+        LogReader reader(inputs, !no_index);
+        ShowStats(reader);
+        std::cout << std::endl;
+
+        if (game >= 0) {
+            LogReader::Game info = reader.GetGame(game);
+            if (move >= 0) {
+                ShowPosition(reader, game, move, top_k);
+            }
+            else {
+                for (int i = 0; i < info.length; i++) {
+                    ShowPosition(reader, game, i, top_k);
+                }
+            }
+        }
+
+        std::mt19937 gen(seed);
+        for (size_t i = 0; i < n_samples; i++) {
+            LogReader::Position position = reader.GetPosition(reader.Sample(gen));
+            ShowPosition(reader, position.game, position.move, top_k);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
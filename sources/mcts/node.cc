@@ -47,6 +47,12 @@ void MCTS::Node::Update(Reward z) {
 }
 
 
+void MCTS::Node::Add(int n_, double w_) {
+    n.fetch_add(n_);
+    w.fetch_add(w_);
+}
+
+
 void MCTS::Node::ApplyVirtualLoss(int vloss) {
     n.fetch_add(vloss);
     w.fetch_sub(vloss);
@@ -1,5 +1,6 @@
 
 #include <iomanip>
+#include <algorithm>
 #include "mcts/tree.h"
 #include "mcts/noise.h"
 
@@ -12,18 +13,21 @@ MCTS::MCTS(const StateBase& init_state, EvaluatorBase& evaluator)
 
 
 MCTS::MCTS
-(const StateBase& init_state, EvaluatorBase& evaluator_, MCTS::Config conf)
+(const StateBase& init_state, EvaluatorBase& evaluator_, MCTS::Config conf,
+ bool expand)
 : config(conf), state(init_state.GetCopy()), evaluator(evaluator_) {
     root = new Node(1);
-    ExpandRoot();
+    if (expand)
+        ExpandRoot();
     StartThreads();
 }
 
-void MCTS::Reset(const StateBase& init_state) {
+void MCTS::Reset(const StateBase& init_state, bool expand) {
     state = init_state.GetCopy();
     delete root;
     root = new Node(1);
-    ExpandRoot();
+    if (expand)
+        ExpandRoot();
 }
 
 
@@ -69,8 +73,9 @@ void MCTS::Search(int times) {
 }
 
 
-void MCTS::SearchThreadJob(int t_idx) {
+void MCTS::SearchThreadJob([[maybe_unused]] int t_idx) {
     // printf("%d search thread started\n", t_idx);
+    int remaining;
     while (true) {
         {
             std::unique_lock<std::mutex> lock(m);
@@ -80,11 +85,10 @@ void MCTS::SearchThreadJob(int t_idx) {
             if (!running)
                 break;
             // printf("%d: counter %d\n", t_idx, counter);
-            counter--;
+            remaining = --counter;
         }
 
-        std::unique_ptr<StateBase> state_copy = state->GetCopy();
-        SingleSearch(state_copy.get(), t_idx);
+        SingleSearch(remaining);
 
         {
             std::unique_lock<std::mutex> lock(m);
@@ -97,28 +101,45 @@ void MCTS::SearchThreadJob(int t_idx) {
 }
 
 
-void MCTS::SingleSearch(StateBase* search_state, int t_idx) {
+void MCTS::SingleSearch(int remaining) {
+    Leaf leaf;
+    if (SelectLeaf(leaf, remaining))
+        BackupLeaf(leaf, evaluator.Evaluate(leaf.state.get(), leaf.hint));
+}
+
+
+bool MCTS::SelectLeaf(MCTS::Leaf& leaf, int remaining) {
     // select
     Node* cur = root;
+    leaf.state = state->GetCopy();
+    leaf.hint = EvalHint();
+    leaf.hint.remaining = remaining;
     while (!cur->IsLeaf()) {
         auto [action, child] = cur->Select(config.p_uct);
-        search_state->Play(action);
+        leaf.state->Play(action);
         cur = child;
         cur->ApplyVirtualLoss(config.virtual_loss);
+        leaf.hint.depth++;
     }
+    leaf.node = cur;
 
-    // evaluate & expand
-    Reward z;
-    if (search_state->Terminated()) {
-        z = search_state->TerminalReward();
-    }
-    else {
-        Evaluation output = evaluator.Evaluate(search_state);
-        z = output.first;
-        cur->Expand(output.second);
+    if (leaf.state->Terminated()) {
+        Backup(cur, leaf.state->TerminalReward());
+        return false;
     }
+    return true;
+}
+
+
+void MCTS::BackupLeaf(MCTS::Leaf& leaf, const Evaluation& output) {
+    // expand
+    leaf.node->Expand(output.second);
+    Backup(leaf.node, output.first);
+    leaf.node = nullptr;
+}
+
 
-    // backup
+void MCTS::Backup(Node* cur, Reward z) {
     while (!cur->IsRoot()) {
         cur->RevertVirtualLoss(config.virtual_loss);
         cur->Update(z);
@@ -129,6 +150,11 @@ void MCTS::SingleSearch(StateBase* search_state, int t_idx) {
 }
 
 
+bool MCTS::RootExpanded() const {
+    return !root->IsLeaf();
+}
+
+
 void MCTS::ExpandRoot() {
     if (!state->Terminated() && root->IsLeaf()) {
         Evaluation output = evaluator.Evaluate(state.get());
@@ -151,6 +177,28 @@ void MCTS::ApplyRootNoise(double alpha, double eps) {
 }
 
 
+void MCTS::AddRootStats(const std::vector<MCTS::ChildStats>& stats) {
+    ExpandRoot();
+    int total_n = 0;
+    double total_w = 0;
+    for (const ChildStats& child: stats) {
+        auto iter = std::find_if(
+            root->children.begin(), root->children.end(),
+            [&](const std::pair<Action, Node*>& action_node) {
+                return action_node.first == child.action;
+            }
+        );
+        if (iter == root->children.end() || child.n <= 0)
+            continue;
+        iter->second->Add(child.n, child.w);
+        total_n += child.n;
+        total_w += child.w;
+    }
+    // the root's reward is for the side that moved into it
+    root->Add(total_n, -total_w);
+}
+
+
 void MCTS::Play(Action action) {
     state->Play(action);
 
@@ -168,6 +216,12 @@ Action MCTS::GetBestAction() const {
 }
 
 
+Reward MCTS::GetRootValue() const {
+    // nodes hold rewards of the side that moved into them
+    return -root->Q();
+}
+
+
 std::vector<MCTS::ActionInfo> MCTS::GetActionInfos() const {
     std::vector<MCTS::ActionInfo> ret;
     for (const auto& [action, node]: root->children) {
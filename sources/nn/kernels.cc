@@ -0,0 +1,340 @@
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#define NN_X86
+#include <immintrin.h>
+#endif
+#include "nn/kernels.h"
+
+
+namespace nn {
+
+namespace {
+
+
+// the vector paths are compiled for their instruction sets alone and picked
+// by the cpu at runtime, so one build runs on any x86 host
+enum class Isa {
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+
+Isa DetectIsa() {
+#if defined(NN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma"))
+        return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return Isa::AVX2;
+#endif
+    return Isa::SCALAR;
+}
+
+
+bool DetectAvx512Bw() {
+#if defined(NN_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512bw");
+#else
+    return false;
+#endif
+}
+
+
+Isa ActiveIsa() {
+    static const Isa isa = DetectIsa();
+    return isa;
+}
+
+
+bool HasAvx512Bw() {
+    static const bool avx512bw = DetectAvx512Bw();
+    return avx512bw;
+}
+
+
+// computes columns [n0, n1) of MB rows starting at A, C, residual
+template <int MB>
+void TileScalar(
+    int n0, int n1, int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C) {
+    for (int n = n0; n < n1; n++) {
+        float acc[MB];
+        for (int i = 0; i < MB; i++)
+            acc[i] = bias ? bias[i] : 0.f;
+        for (int k = 0; k < K; k++) {
+            float b = B[(size_t)k * N + n];
+            for (int i = 0; i < MB; i++)
+                acc[i] += A[(size_t)i * K + k] * b;
+        }
+        for (int i = 0; i < MB; i++) {
+            float v = acc[i];
+            if (residual)
+                v += residual[(size_t)i * N + n];
+            if (relu)
+                v = std::max(v, 0.f);
+            C[(size_t)i * N + n] = v;
+        }
+    }
+}
+
+
+#if defined(NN_X86)
+// 32 columns of MB rows, the accumulators stay in registers over K
+template <int MB>
+__attribute__((target("avx512f,fma")))
+void TileAvx512(
+    int n0, int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C) {
+    __m512 acc[MB][2];
+    for (int i = 0; i < MB; i++) {
+        acc[i][0] = acc[i][1] = _mm512_set1_ps(bias ? bias[i] : 0.f);
+    }
+    for (int k = 0; k < K; k++) {
+        const float* b_row = B + (size_t)k * N + n0;
+        __m512 b0 = _mm512_loadu_ps(b_row);
+        __m512 b1 = _mm512_loadu_ps(b_row + 16);
+        for (int i = 0; i < MB; i++) {
+            __m512 a = _mm512_set1_ps(A[(size_t)i * K + k]);
+            acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+        }
+    }
+    __m512 zero = _mm512_setzero_ps();
+    for (int i = 0; i < MB; i++) {
+        float* c_row = C + (size_t)i * N + n0;
+        for (int j = 0; j < 2; j++) {
+            if (residual) {
+                acc[i][j] = _mm512_add_ps(acc[i][j], 
+                    _mm512_loadu_ps(residual + (size_t)i * N + n0 + 16 * j));
+            }
+            if (relu)
+                acc[i][j] = _mm512_max_ps(acc[i][j], zero);
+            _mm512_storeu_ps(c_row + 16 * j, acc[i][j]);
+        }
+    }
+}
+#endif
+
+
+#if defined(NN_X86)
+// 16 columns of MB rows, the accumulators stay in registers over K
+template <int MB>
+__attribute__((target("avx2,fma")))
+void TileAvx2(
+    int n0, int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C) {
+    __m256 acc[MB][2];
+    for (int i = 0; i < MB; i++) {
+        acc[i][0] = acc[i][1] = _mm256_set1_ps(bias ? bias[i] : 0.f);
+    }
+    for (int k = 0; k < K; k++) {
+        const float* b_row = B + (size_t)k * N + n0;
+        __m256 b0 = _mm256_loadu_ps(b_row);
+        __m256 b1 = _mm256_loadu_ps(b_row + 8);
+        for (int i = 0; i < MB; i++) {
+            __m256 a = _mm256_broadcast_ss(A + (size_t)i * K + k);
+            acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+        }
+    }
+    __m256 zero = _mm256_setzero_ps();
+    for (int i = 0; i < MB; i++) {
+        float* c_row = C + (size_t)i * N + n0;
+        for (int j = 0; j < 2; j++) {
+            if (residual) {
+                acc[i][j] = _mm256_add_ps(acc[i][j], 
+                    _mm256_loadu_ps(residual + (size_t)i * N + n0 + 8 * j));
+            }
+            if (relu)
+                acc[i][j] = _mm256_max_ps(acc[i][j], zero);
+            _mm256_storeu_ps(c_row + 8 * j, acc[i][j]);
+        }
+    }
+}
+#endif
+
+
+template <int MB>
+void Rows(
+    int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C) {
+    int n = 0;
+#if defined(NN_X86)
+    Isa isa = ActiveIsa();
+    if (isa == Isa::AVX512) {
+        for (; n + 32 <= N; n += 32)
+            TileAvx512<MB>(n, N, K, A, B, bias, residual, relu, C);
+    }
+    if (isa != Isa::SCALAR) {
+        for (; n + 16 <= N; n += 16)
+            TileAvx2<MB>(n, N, K, A, B, bias, residual, relu, C);
+    }
+#endif
+    TileScalar<MB>(n, N, N, K, A, B, bias, residual, relu, C);
+}
+
+
+#if defined(NN_X86)
+// chunks are aligned to the chunk width, so none straddles two words
+__attribute__((target("avx512f")))
+int ExpandBitsAvx512(int n, const uint64_t* bits, float* out) {
+    int i = 0;
+    const __m512 ones = _mm512_set1_ps(1.f);
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 m = (__mmask16)(bits[i >> 6] >> (i & 63));
+        _mm512_storeu_ps(out + i, _mm512_maskz_mov_ps(m, ones));
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2")))
+int ExpandBitsAvx2(int n, const uint64_t* bits, float* out) {
+    int i = 0;
+    const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 ones = _mm256_set1_ps(1.f);
+    for (; i + 8 <= n; i += 8) {
+        __m256i b = _mm256_set1_epi32((int)(bits[i >> 6] >> (i & 63)) & 0xff);
+        __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(b, select), select);
+        _mm256_storeu_ps(
+            out + i, _mm256_and_ps(_mm256_castsi256_ps(hit), ones));
+    }
+    return i;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+int ExpandBitsAvx512Bw(int n, const uint64_t* bits, uint8_t* out) {
+    int i = 0;
+    const __m512i ones = _mm512_set1_epi8(1);
+    for (; i + 64 <= n; i += 64) {
+        _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi8(bits[i >> 6], ones));
+    }
+    return i;
+}
+#endif
+
+
+}
+
+
+void Gemm(
+    int M, int N, int K, 
+    const float* A, const float* B, const float* bias, const float* residual,
+    bool relu, float* C) {
+    int m = 0;
+    for (; m + 4 <= M; m += 4) {
+        Rows<4>(N, K, A + (size_t)m * K, B, bias ? bias + m : nullptr,
+            residual ? residual + (size_t)m * N : nullptr, relu, 
+            C + (size_t)m * N);
+    }
+    for (; m < M; m++) {
+        Rows<1>(N, K, A + (size_t)m * K, B, bias ? bias + m : nullptr,
+            residual ? residual + (size_t)m * N : nullptr, relu, 
+            C + (size_t)m * N);
+    }
+}
+
+
+void Im2Col3x3(
+    int channels, int batch, int h, int w, const float* input, float* col) {
+    const size_t plane = (size_t)h * w;
+    const size_t width = batch * plane;
+    for (int c = 0; c < channels; c++) {
+        for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+                float* dst = col + (size_t)(c * 9 + ky * 3 + kx) * width;
+                for (int b = 0; b < batch; b++) {
+                    const float* src = input + c * width + b * plane;
+                    float* dst_b = dst + b * plane;
+                    for (int y = 0; y < h; y++) {
+                        int sy = y + ky - 1;
+                        float* dst_row = dst_b + y * w;
+                        if (sy < 0 || sy >= h) {
+                            std::fill_n(dst_row, w, 0.f);
+                            continue;
+                        }
+                        const float* src_row = src + sy * w;
+                        // only the first or last column falls off the board
+                        int x0 = std::max(0, 1 - kx);
+                        int x1 = std::min(w, w + 1 - kx);
+                        if (x0 > 0)
+                            dst_row[0] = 0.f;
+                        std::copy(src_row + x0 + kx - 1, src_row + x1 + kx - 1, 
+                            dst_row + x0);
+                        if (x1 < w)
+                            dst_row[w - 1] = 0.f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void MaskedSoftmax(int n, const float* logits, const uint8_t* mask, float* probs) {
+    float max_logit = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < n; i++) {
+        if (!mask[i])
+            max_logit = std::max(max_logit, logits[i]);
+    }
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        probs[i] = mask[i] ? 0.f : std::exp(logits[i] - max_logit);
+        sum += probs[i];
+    }
+    if (sum > 0) {
+        for (int i = 0; i < n; i++)
+            probs[i] /= sum;
+    }
+}
+
+
+void ExpandBits(int n, const uint64_t* bits, float* out) {
+    int i = 0;
+#if defined(NN_X86)
+    Isa isa = ActiveIsa();
+    if (isa == Isa::AVX512)
+        i = ExpandBitsAvx512(n, bits, out);
+    else if (isa == Isa::AVX2)
+        i = ExpandBitsAvx2(n, bits, out);
+#endif
+    for (; i < n; i++)
+        out[i] = (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+
+void ExpandBits(int n, const uint64_t* bits, uint8_t* out) {
+    int i = 0;
+#if defined(NN_X86)
+    if (HasAvx512Bw())
+        i = ExpandBitsAvx512Bw(n, bits, out);
+#endif
+    for (; i < n; i++)
+        out[i] = (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+
+const char* KernelIsa() {
+    switch (ActiveIsa()) {
+    case Isa::AVX512:
+        return "avx512";
+    case Isa::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+
+}
+
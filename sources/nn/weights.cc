@@ -0,0 +1,115 @@
+
+#include <fstream>
+#include <exception>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#include "nn/weights.h"
+
+
+namespace nn {
+
+
+size_t Tensor::Numel() const {
+    size_t numel = 1;
+    for (int dim: shape)
+        numel *= dim;
+    return numel;
+}
+
+
+WeightFile::WeightFile(const std::string& path) {
+    Load(path);
+}
+
+
+void WeightFile::Load(const std::string& path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        throw std::runtime_error("weights load from " + path + ": cannot open");
+
+    auto read_u32 = [&]() {
+        uint32_t value;
+        if (!in.read((char*)&value, sizeof(value)))
+            throw std::runtime_error("weights load from " + path + ": truncated");
+        return value;
+    };
+
+    if (read_u32() != MAGIC)
+        throw std::runtime_error("weights load from " + path + ": bad magic");
+    uint32_t version = read_u32();
+    if (version != VERSION)
+        throw std::runtime_error(fmt::format(
+            "weights load from {}: unsupported version {}", path, version));
+
+    tensors.clear();
+    uint32_t count = read_u32();
+    for (uint32_t i = 0; i < count; i++) {
+        std::string name(read_u32(), '\0');
+        in.read(name.data(), name.size());
+        Tensor tensor;
+        tensor.shape.resize(read_u32());
+        for (int& dim: tensor.shape)
+            dim = (int)read_u32();
+        tensor.data.resize(tensor.Numel());
+        if (!in.read((char*)tensor.data.data(), sizeof(float) * tensor.data.size()))
+            throw std::runtime_error("weights load from " + path + ": truncated");
+        tensors.emplace(std::move(name), std::move(tensor));
+    }
+}
+
+
+void WeightFile::Save(const std::string& path) const {
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if (!out.is_open())
+        throw std::runtime_error("weights save to " + path + ": cannot open");
+
+    auto write_u32 = [&](uint32_t value) {
+        out.write((char*)&value, sizeof(value));
+    };
+
+    write_u32(MAGIC);
+    write_u32(VERSION);
+    write_u32(tensors.size());
+    for (const auto& [name, tensor]: tensors) {
+        write_u32(name.size());
+        out.write(name.data(), name.size());
+        write_u32(tensor.shape.size());
+        for (int dim: tensor.shape)
+            write_u32(dim);
+        out.write((char*)tensor.data.data(), sizeof(float) * tensor.data.size());
+    }
+    out.close();
+}
+
+
+bool WeightFile::Has(const std::string& name) const {
+    return tensors.count(name) > 0;
+}
+
+
+const Tensor& WeightFile::Get(const std::string& name) const {
+    auto iter = tensors.find(name);
+    if (iter == tensors.end())
+        throw std::runtime_error("weights: missing tensor " + name);
+    return iter->second;
+}
+
+
+const Tensor& WeightFile::Get
+(const std::string& name, const std::vector<int>& shape) const {
+    const Tensor& tensor = Get(name);
+    if (tensor.shape != shape)
+        throw std::runtime_error(fmt::format(
+            "weights: tensor {} has shape [{}], expected [{}]", name, 
+            fmt::join(tensor.shape, ", "), fmt::join(shape, ", ")));
+    return tensor;
+}
+
+
+void WeightFile::Put(const std::string& name, Tensor tensor) {
+    tensors[name] = std::move(tensor);
+}
+
+
+}
+
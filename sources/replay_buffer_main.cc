@@ -0,0 +1,136 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <csignal>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include <fmt/format.h>
+#include "gomoku/replay_buffer.h"
+
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+using gomoku::logger::ReplayBuffer;
+using gomoku::logger::MiniBatchHeader;
+
+
+// false once the reading end is gone
+bool WriteMiniBatch(const ReplayBuffer::MiniBatch& batch, FILE* out) {
+    MiniBatchHeader header;
+    header.n = batch.size;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (const std::vector<float>* array: 
+        {&batch.states, &batch.policies, &batch.values, &batch.weights}) {
+        ok = ok && fwrite(array->data(), sizeof(float), array->size(), out) 
+            == array->size();
+    }
+    return ok && fflush(out) == 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    ReplayBuffer::Config config;
+    size_t n_batches;
+
+    po::options_description desc("replay buffer config");
+    desc.add_options()
+        ("help,h", "usage")
+        (
+            "dirs",
+            po::value<std::vector<fs::path>>(&config.dirs)->multitoken()
+                ->required(),
+            "directories selfplay writes game logs or shards to"
+        )
+        (
+            "max_games",
+            po::value<size_t>(&config.max_games)->default_value(0),
+            "most recent games kept in the window, 0 for no bound"
+        )
+        (
+            "max_positions",
+            po::value<size_t>(&config.max_positions)->default_value(1000000),
+            "positions kept in the window, 0 for no bound"
+        )
+        (
+            "min_positions",
+            po::value<size_t>(&config.min_positions)->default_value(10000),
+            "positions the window holds before the first minibatch"
+        )
+        (
+            "batch_size",
+            po::value<size_t>(&config.batch_size)->default_value(256),
+            "positions per minibatch"
+        )
+        (
+            "n_threads",
+            po::value<size_t>(&config.n_threads)->default_value(2),
+            "number of threads sampling minibatches"
+        )
+        (
+            "prefetch",
+            po::value<size_t>(&config.prefetch)->default_value(8),
+            "minibatches sampled ahead of the reader"
+        )
+        (
+            "augment",
+            po::bool_switch(&config.augment),
+            "give every sample a random board symmetry"
+        )
+        (
+            "poll_interval",
+            po::value<double>(&config.poll_interval)->default_value(5),
+            "seconds between looking for new games"
+        )
+        (
+            "save_index",
+            po::bool_switch(&config.save_index),
+            "save the indices built for the logs as .idx next to them"
+        )
+        (
+            "n_batches",
+            po::value<size_t>(&n_batches)->default_value(0),
+            "stop after this many minibatches, 0 to stream until stdout "
+            "is closed"
+        )
+    ;
+    po::positional_options_description positional;
+    positional.add("dirs", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+            .options(desc).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    // minibatches go to stdout, everything else to stderr, and a trainer
+    // closing the pipe ends the stream instead of killing the process
+    std::signal(SIGPIPE, SIG_IGN);
+    try {
+        std::cerr << config << std::endl;
+        ReplayBuffer buffer(config);
+        std::cerr << fmt::format("window: {} games, {} positions",
+            buffer.NumGames(), buffer.NumPositions()) << std::endl;
+
+        ReplayBuffer::MiniBatch batch;
+        for (size_t i = 0; n_batches == 0 || i < n_batches; i++) {
+            if (!buffer.Next(batch) || !WriteMiniBatch(batch, stdout))
+                break;
+        }
+        buffer.Stop();
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <boost/program_options.hpp>
+#include "gomoku/selfeval.h"
+
+
+namespace po = boost::program_options;
+
+
+
+
+int main(int argc, char *argv[]) {
+    
+    gomoku::selfeval::Server::Config config;
+    po::options_description gen_cfg("generic config");
+    gen_cfg.add_options()
+        ("help,h", "usage")
+    ;
+    // both agents search with the same mcts settings
+    mcts::MCTS::Config mcts_config;
+    po::options_description mcts_cfg = 
+        mcts::GetMCTSConfig(mcts_config);
+    po::options_description ev_cfg = 
+        gomoku::GetEvaluatorConfig(config.ld_cfg.ev_cfg);
+    po::options_description eq_cfg = 
+        gomoku::GetEvaluationQueueConfig(config.eq_cfg);
+    po::options_description selfeval_cfg 
+        = gomoku::selfeval::GetSelfevalConfig(config);
+    po::options_description options;
+    options.add(mcts_cfg).add(ev_cfg).add(eq_cfg).add(selfeval_cfg);
+
+    
+    po::variables_map vm;
+    po::parsed_options parsed = po::command_line_parser(argc, argv)
+        .options(gen_cfg)
+        .allow_unregistered()
+        .run();
+    try {
+        po::store(parsed, vm);
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << gen_cfg << std::endl;
+        std::cout << mcts_cfg << std::endl;
+        std::cout << ev_cfg << std::endl;
+        std::cout << eq_cfg << std::endl;
+        std::cout << selfeval_cfg << std::endl;
+        std::cout << "exits with 0 when model1 passes, 2 when it fails or "
+            "the test is undecided after max_games" << std::endl;
+        return 0;
+    }
+
+    
+    std::vector<std::string> unrec
+        = po::collect_unrecognized(parsed.options, po::include_positional);
+    try {
+        parsed = po::command_line_parser(unrec).options(options).run();
+        po::store(parsed, vm);
+        po::notify(vm);
+    }
+    catch (po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    config.agent1.mcts_cfg = mcts_config;
+    config.agent2.mcts_cfg = mcts_config;
+
+    std::cout << "===== Selfeval Settings =====\n";
+    std::cout << config << "\n";
+    std::cout << "=============================" << std::endl;
+
+    std::cout << std::endl;
+
+    try {
+        gomoku::selfeval::Server server(config);
+        server.LoadEvauator();
+        std::cout << std::endl;
+
+        gomoku::selfeval::SPRT::Result result = server.Run();
+        return result == gomoku::selfeval::SPRT::Result::H1 ? 0 : 2;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
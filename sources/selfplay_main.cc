@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <csignal>
 #include <boost/program_options.hpp>
 #include "gomoku/selfplay.h"
 
@@ -22,10 +23,14 @@ int main(int argc, char *argv[]) {
     ;
     po::options_description mcts_cfg = 
         mcts::GetMCTSConfig(config.mcts_cfg);
+    po::options_description ev_cfg = 
+        gomoku::GetEvaluatorConfig(config.ev_cfg);
+    po::options_description eq_cfg = 
+        gomoku::GetEvaluationQueueConfig(config.eq_cfg);
     po::options_description selfpaly_cfg 
         = gomoku::selfplay::GetSelfplayConfig(config);
     po::options_description options;
-    options.add(mcts_cfg).add(selfpaly_cfg);
+    options.add(mcts_cfg).add(ev_cfg).add(eq_cfg).add(selfpaly_cfg);
 
     
     po::variables_map vm;
@@ -44,6 +49,8 @@ int main(int argc, char *argv[]) {
     if (vm.count("help")) {
         std::cout << gen_cfg << std::endl;
         std::cout << mcts_cfg << std::endl;
+        std::cout << ev_cfg << std::endl;
+        std::cout << eq_cfg << std::endl;
         std::cout << selfpaly_cfg << std::endl;
         return 0;
     }
@@ -71,13 +78,18 @@ int main(int argc, char *argv[]) {
     try {
         server.LoadEvauator();
     }
-    catch (const c10::Error& e) {
+    catch (const std::exception& e) {
         std::cerr << "error loading the model" << std::endl;
         std::cerr << e.what() << std::endl;
         return 1;
     }
     
     std::cout << std::endl;
+
+    // kill -HUP reloads the checkpoint at model_path without a restart
+    std::signal(SIGHUP, [](int) {
+        gomoku::selfplay::Server::RequestReload();
+    });
     
     server.Run();
 